@@ -1,5 +1,147 @@
 #include "shader.h"
 
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+// Program binary cache: a linked program is saved as dir/<key>.bin with
+// glGetProgramBinary and loaded with glProgramBinary the next time the same sources
+// are loaded, skipping compile and link. The key hashes the sources with the driver's
+// vendor, renderer and version strings, so a driver update or another gpu misses.
+// Entries that are truncated, corrupt or refused by the driver are compiled again
+// and overwritten.
+static std::string ShaderCacheDir = "shader_cache";
+static const char ShaderCacheMagic[8] = { 'G', 'L', 'P', 'B', 'I', 'N', '0', '1' };
+
+void SetShaderCacheDir(const char* dir) {
+    ShaderCacheDir = dir ? dir : "";
+}
+
+// FNV-1a, 64 bits
+static void HashBytes(unsigned long long& h, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+}
+
+static void HashString(unsigned long long& h, const char* s) {
+    // the terminator too, so "ab"+"c" and "a"+"bc" differ
+    if (s)
+        HashBytes(h, s, strlen(s) + 1);
+    else
+        HashBytes(h, "", 1);
+}
+
+static bool ProgramBinarySupported() {
+    if (ShaderCacheDir.empty() || !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary))
+        return false;
+    GLint Formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &Formats);
+    return Formats > 0;
+}
+
+// types[i] is the stage of sources[i]
+static std::string ProgramCachePath(const GLenum* types, const std::string* const* sources, int count) {
+    unsigned long long h = 14695981039346656037ULL;
+    HashString(h, (const char*)glGetString(GL_VENDOR));
+    HashString(h, (const char*)glGetString(GL_RENDERER));
+    HashString(h, (const char*)glGetString(GL_VERSION));
+    for (int i = 0; i < count; i++) {
+        HashBytes(h, &types[i], sizeof(types[i]));
+        HashString(h, sources[i]->c_str());
+    }
+    char Name[32];
+    sprintf(Name, "/%016llx.bin", h);
+    return ShaderCacheDir + Name;
+}
+
+// 0 when there is no usable entry
+static GLuint LoadCachedProgram(const std::string& path) {
+    std::ifstream In(path.c_str(), std::ios::in | std::ios::binary);
+    if (!In.is_open())
+        return 0;
+    char Magic[8];
+    unsigned int Format = 0, Length = 0;
+    unsigned long long Checksum = 0;
+    In.read(Magic, sizeof(Magic));
+    In.read((char*)&Format, sizeof(Format));
+    In.read((char*)&Length, sizeof(Length));
+    In.read((char*)&Checksum, sizeof(Checksum));
+    std::vector<char> Binary;
+    if (In.good() && memcmp(Magic, ShaderCacheMagic, sizeof(Magic)) == 0 && Length > 0 && Length < (1u << 30)) {
+        Binary.resize(Length);
+        In.read(&Binary[0], Length);
+    }
+    unsigned long long h = 14695981039346656037ULL;
+    if (!Binary.empty())
+        HashBytes(h, &Binary[0], Binary.size());
+    if (Binary.empty() || !In.good() || h != Checksum) {
+        printf("Ignoring corrupt shader cache entry %s\n", path.c_str());
+        return 0;
+    }
+
+    GLuint ProgramID = glCreateProgram();
+    glProgramBinary(ProgramID, (GLenum)Format, &Binary[0], (GLsizei)Length);
+    GLint Result = GL_FALSE;
+    glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+    if (Result != GL_TRUE) {
+        // another driver build than the one that wrote it
+        glDeleteProgram(ProgramID);
+        return 0;
+    }
+    return ProgramID;
+}
+
+static void SaveCachedProgram(GLuint ProgramID, const std::string& path) {
+    GLint Length = 0;
+    glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &Length);
+    if (Length <= 0)
+        return;
+    std::vector<char> Binary(Length);
+    GLenum Format = 0;
+    glGetProgramBinary(ProgramID, Length, &Length, &Format, &Binary[0]);
+    if (Length <= 0)
+        return;
+    unsigned int StoredFormat = Format, StoredLength = (unsigned int)Length;
+    unsigned long long Checksum = 14695981039346656037ULL;
+    HashBytes(Checksum, &Binary[0], StoredLength);
+
+#ifdef _WIN32
+    _mkdir(ShaderCacheDir.c_str());
+#else
+    mkdir(ShaderCacheDir.c_str(), 0755);
+#endif
+    // written aside and renamed, so threads and processes loading the same program
+    // never read half an entry
+    char Suffix[32];
+    sprintf(Suffix, ".%08x.tmp", (unsigned int)std::random_device()());
+    std::string TempPath = path + Suffix;
+    {
+        std::ofstream Out(TempPath.c_str(), std::ios::out | std::ios::binary);
+        Out.write(ShaderCacheMagic, sizeof(ShaderCacheMagic));
+        Out.write((const char*)&StoredFormat, sizeof(StoredFormat));
+        Out.write((const char*)&StoredLength, sizeof(StoredLength));
+        Out.write((const char*)&Checksum, sizeof(Checksum));
+        Out.write(&Binary[0], StoredLength);
+        if (!Out.good()) {
+            Out.close();
+            remove(TempPath.c_str());
+            return;
+        }
+    }
+#ifdef _WIN32
+    // rename does not replace on windows
+    remove(path.c_str());
+#endif
+    if (rename(TempPath.c_str(), path.c_str()) != 0)
+        remove(TempPath.c_str());
+}
+
 GLuint LoadShaders(const char* vertex_file_path, const char* fragment_file_path, const char* geometry_file_path) {
 
     // Create the shaders
@@ -45,6 +187,21 @@ GLuint LoadShaders(const char* vertex_file_path, const char* fragment_file_path,
         }
     }
 
+    // a binary of the same sources linked by this driver before
+    std::string CachePath;
+    if (ProgramBinarySupported()) {
+        GLenum Types[3] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+        const std::string* Sources[3] = { &VertexShaderCode, &FragmentShaderCode, &GeometryShaderCode };
+        CachePath = ProgramCachePath(Types, Sources, geometry_file_path != nullptr ? 3 : 2);
+        GLuint CachedID = LoadCachedProgram(CachePath);
+        if (CachedID) {
+            glDeleteShader(VertexShaderID);
+            glDeleteShader(FragmentShaderID);
+            glDeleteShader(GeometryShaderID);
+            return CachedID;
+        }
+    }
+
     GLint Result = GL_FALSE;
     int InfoLogLength;
 
@@ -115,6 +272,8 @@ GLuint LoadShaders(const char* vertex_file_path, const char* fragment_file_path,
     {
         glAttachShader(ProgramID, GeometryShaderID);
     }
+    if (!CachePath.empty())
+        glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(ProgramID);
 
     // Check the program
@@ -125,6 +284,8 @@ GLuint LoadShaders(const char* vertex_file_path, const char* fragment_file_path,
         glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
         printf("%s\n", &ProgramErrorMessage[0]);
     }
+    if (Result == GL_TRUE && !CachePath.empty())
+        SaveCachedProgram(ProgramID, CachePath);
 
 
     glDetachShader(ProgramID, VertexShaderID);
@@ -136,6 +297,79 @@ GLuint LoadShaders(const char* vertex_file_path, const char* fragment_file_path,
     return ProgramID;
 }
 
+GLuint LoadComputeShader(const char* compute_file_path) {
+
+    // Read the Compute Shader code from the file
+    std::string ComputeShaderCode;
+    std::ifstream ComputeShaderStream(compute_file_path, std::ios::in);
+    if (ComputeShaderStream.is_open()) {
+        std::string Line = "";
+        while (getline(ComputeShaderStream, Line))
+            ComputeShaderCode += "\n" + Line;
+        ComputeShaderStream.close();
+    }
+    else {
+        printf("Impossible to open %s. Are you in the right directory ?\n", compute_file_path);
+        return 0;
+    }
+
+    std::string CachePath;
+    if (ProgramBinarySupported()) {
+        GLenum Type = GL_COMPUTE_SHADER;
+        const std::string* Source = &ComputeShaderCode;
+        CachePath = ProgramCachePath(&Type, &Source, 1);
+        GLuint CachedID = LoadCachedProgram(CachePath);
+        if (CachedID)
+            return CachedID;
+    }
+
+    GLint Result = GL_FALSE;
+    int InfoLogLength;
+
+    // Compile Compute Shader
+    GLuint ComputeShaderID = glCreateShader(GL_COMPUTE_SHADER);
+    char const * ComputeSourcePointer = ComputeShaderCode.c_str();
+    glShaderSource(ComputeShaderID, 1, &ComputeSourcePointer, NULL);
+    glCompileShader(ComputeShaderID);
+
+    // Check Compute Shader
+    glGetShaderiv(ComputeShaderID, GL_COMPILE_STATUS, &Result);
+    glGetShaderiv(ComputeShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+    if (InfoLogLength > 0) {
+        std::vector<char> ComputeShaderErrorMessage(InfoLogLength + 1);
+        glGetShaderInfoLog(ComputeShaderID, InfoLogLength, NULL, &ComputeShaderErrorMessage[0]);
+        printf("%s\n", &ComputeShaderErrorMessage[0]);
+    }
+
+    // Link the program
+    GLuint ProgramID = glCreateProgram();
+    glAttachShader(ProgramID, ComputeShaderID);
+    if (!CachePath.empty())
+        glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(ProgramID);
+
+    // Check the program; unlike the draw programs a broken one is not returned,
+    // a dispatch of it would fail silently
+    glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+    glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+    if (InfoLogLength > 0) {
+        std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
+        glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+        printf("%s\n", &ProgramErrorMessage[0]);
+    }
+
+    glDetachShader(ProgramID, ComputeShaderID);
+    glDeleteShader(ComputeShaderID);
+
+    if (Result != GL_TRUE) {
+        glDeleteProgram(ProgramID);
+        return 0;
+    }
+    if (!CachePath.empty())
+        SaveCachedProgram(ProgramID, CachePath);
+    return ProgramID;
+}
+
 #ifdef OPENCV_REQUIRED
 GLuint LoadTexture2D(cv::Mat &img)
 {
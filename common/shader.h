@@ -26,6 +26,12 @@ GLuint LoadTexture2D(const char * texture_image_path);
 #endif
 
 GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path, const char* geometry_file_path = nullptr);
+// a program of a single compute shader, 0 if it cannot be read or linked
+GLuint LoadComputeShader(const char * compute_file_path);
+// where both loaders keep linked program binaries (GL 4.1 or ARB_get_program_binary),
+// created on the first save; "shader_cache" in the working directory by default,
+// nullptr or "" turns the cache off. Set it before loading on other threads
+void SetShaderCacheDir(const char * dir);
 
 
 GLuint generateAttachmentTexture(GLboolean depth, GLboolean stencil, GLsizei screenWidth, GLsizei screenHeight);
@@ -2,11 +2,13 @@
 // Interpolated values from the vertex shaders
 in vec4 vpos;
 
-layout(location = 0) out vec3 color;
+// R16UI target, holds the value written to the png
+layout(location = 0) out uint depth;
 
 void main(){
 	//color = vec3(gl_FragCoord.z);
-	color = vec3(vpos.z/1000.0);
+	// same unit as the former cpu path: (z/1000) * 10000, rounded and saturated like cv::convertTo
+	depth = uint(clamp(roundEven(vpos.z*10.0), 0.0, 65535.0));
 
 	//color = vec3(1.0f);
 }
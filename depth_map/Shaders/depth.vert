@@ -3,8 +3,11 @@
 layout(location = 0) in vec3 vpos_modelspace;
 // Values that stay constant for the whole mesh.
 uniform mat4 MVP;
+// index of the point in the buffer, for the point id target
+flat out uint vertex_id;
 
 void main(){
   vec4 vpos = MVP * vec4(vpos_modelspace,1);
   gl_Position = vpos;
+  vertex_id = uint(gl_VertexID);
 }
@@ -0,0 +1,28 @@
+#version 450 core
+// depth.vert for --splat-size adaptive: every point also carries its local spacing,
+// and its square is sized from that and its depth instead of a fixed patchsize.
+layout(location = 0) in vec3 vpos_modelspace;
+layout(location = 1) in float spacing;
+
+// clip space half size of the square, for depth_adaptive.geo
+out vec2 radius;
+flat out uint vertex_id;
+
+uniform mat4 MVP;
+// pixel focal lengths of the camera (fx, fy) and the viewport size
+uniform vec2 focal;
+uniform vec2 viewport;
+// half width and height in pixels: splat_scale*spacing*focal/depth per axis, each
+// within [splat_min, splat_max]; a rectangle when the pixels are not square
+uniform float splat_scale;
+uniform float splat_min;
+uniform float splat_max;
+
+void main(){
+  vec4 vpos = MVP * vec4(vpos_modelspace,1);
+  // w is the depth along the camera axis
+  vec2 r = clamp(splat_scale*spacing*focal/vpos.w, vec2(splat_min), vec2(splat_max));
+  radius = r*2.0/viewport*vpos.w;
+  gl_Position = vpos;
+  vertex_id = uint(gl_VertexID);
+}
@@ -0,0 +1,10 @@
+#version 450 core
+// Interpolated values from the vertex shaders
+in vec4 vpos;
+
+// R32F target for --dtype f32, unquantized (depth.frag writes this times 10000)
+layout(location = 0) out float depth;
+
+void main(){
+	depth = vpos.z/1000.0;
+}
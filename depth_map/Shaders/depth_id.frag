@@ -0,0 +1,13 @@
+#version 450 core
+// depth.frag plus the index of the point that wins the pixel, in the same draw,
+// into the R32UI point id target (attachment 1)
+in vec4 vpos;
+flat in uint point_id;
+
+layout(location = 0) out uint depth;
+layout(location = 1) out uint id;
+
+void main(){
+	depth = uint(clamp(roundEven(vpos.z*10.0), 0.0, 65535.0));
+	id = point_id;
+}
@@ -0,0 +1,12 @@
+#version 450 core
+// depth_f32.frag plus the point id target, like depth_id.frag
+in vec4 vpos;
+flat in uint point_id;
+
+layout(location = 0) out float depth;
+layout(location = 1) out uint id;
+
+void main(){
+	depth = vpos.z/1000.0;
+	id = point_id;
+}
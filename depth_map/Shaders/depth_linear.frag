@@ -0,0 +1,12 @@
+#version 450 core
+// Resolves depth_only.frag's depth buffer into the R16UI target with depth.frag's
+// quantization; the cleared value 1.0 becomes 0 (no point).
+
+uniform sampler2D src;
+
+layout(location = 0) out uint depth;
+
+void main(){
+	float d = texelFetch(src, ivec2(gl_FragCoord.xy), 0).r;
+	depth = d == 1.0 ? 0u : uint(clamp(roundEven(d*10000.0), 0.0, 65535.0));
+}
@@ -0,0 +1,11 @@
+#version 450 core
+// depth_linear.frag for the R32F target of --dtype f32
+
+uniform sampler2D src;
+
+layout(location = 0) out float depth;
+
+void main(){
+	float d = texelFetch(src, ivec2(gl_FragCoord.xy), 0).r;
+	depth = d == 1.0 ? 0.0 : d;
+}
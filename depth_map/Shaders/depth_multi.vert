@@ -0,0 +1,22 @@
+#version 450 core
+// depth.vert for cloud_batch (.scene jobs): the points of every cloud are in its own
+// frame and its model matrix comes from an SSBO, at the index the draw_id attribute
+// holds. That attribute has divisor 1, so each draw of the multi draw reads it at its
+// baseInstance, the cloud's index.
+layout(location = 0) in vec3 vpos_modelspace;
+layout(location = 2) in uint draw_id;
+
+layout(std430, binding = 0) readonly buffer cloud_models
+{
+	mat4 model[];
+};
+
+// the camera's, for the world the models map into
+uniform mat4 MVP;
+flat out uint vertex_id;
+
+void main(){
+  vec4 vpos = MVP * (model[draw_id] * vec4(vpos_modelspace,1));
+  gl_Position = vpos;
+  vertex_id = uint(gl_VertexID);
+}
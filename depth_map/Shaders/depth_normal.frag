@@ -0,0 +1,69 @@
+#version 450 core
+// Normal map of the rendered depth image, drawn over it with depth_pool.vert. Every
+// pixel is unprojected with the inverse MVP and its normal is the cross product of
+// the central differences between its horizontal and between its vertical
+// neighbours, one sided where a side is empty or an edge. Normals are unit vectors in the cloud's
+// frame turned towards the camera, 0 where there is no depth or no neighbour.
+
+uniform usampler2D src;       // R16UI target, png units
+uniform sampler2D src_f32;    // R32F target of --dtype f32, on its own unit
+uniform bool float_output;
+uniform mat4 inverse_mvp;
+// clip z = a*w + b, w the depth along the camera axis
+uniform vec2 depth_ab;
+// a neighbour is across an edge when its depth step is over edge_ratio times the other
+// side's plus edge_slack (clip units, about the u16 quantization)
+const float edge_ratio = 4.0;
+const float edge_slack = 0.5;
+
+layout(location = 0) out vec4 normal;
+
+ivec2 image_size(){
+	return float_output ? textureSize(src_f32, 0) : textureSize(src, 0);
+}
+
+// clip space z of pixel p, 0 if empty
+float clip_z(ivec2 p){
+	return float_output ? texelFetch(src_f32, p, 0).r*1000.0 : float(texelFetch(src, p, 0).r)/10.0;
+}
+
+vec3 unproject(ivec2 p, float z){
+	vec2 ndc = (vec2(p) + 0.5)/vec2(image_size())*2.0 - 1.0;
+	float w = (z - depth_ab.y)/depth_ab.x;
+	vec4 world = inverse_mvp*vec4(ndc*w, z, w);
+	return world.xyz/world.w;
+}
+
+// central difference along step; one sided towards the nearer neighbour in depth when
+// the other is missing or across an edge, 0 if neither is valid
+vec3 tangent(ivec2 p, float z, vec3 center, ivec2 step){
+	ivec2 size = image_size();
+	ivec2 a = p - step, b = p + step;
+	float za = all(greaterThanEqual(a, ivec2(0))) ? clip_z(a) : 0.0;
+	float zb = all(lessThan(b, size)) ? clip_z(b) : 0.0;
+	if (za == 0.0 && zb == 0.0)
+		return vec3(0.0);
+	float da = abs(za - z), db = abs(zb - z);
+	if (za != 0.0 && zb != 0.0 && max(da, db) <= edge_ratio*min(da, db) + edge_slack)
+		return (unproject(b, zb) - unproject(a, za))*0.5;
+	if (zb == 0.0 || (za != 0.0 && da < db))
+		return center - unproject(a, za);
+	return unproject(b, zb) - center;
+}
+
+void main(){
+	ivec2 p = ivec2(gl_FragCoord.xy);
+	float z = clip_z(p);
+	normal = vec4(0.0);
+	if (z == 0.0)
+		return;
+	vec3 center = unproject(p, z);
+	vec3 n = cross(tangent(p, z, center, ivec2(1, 0)), tangent(p, z, center, ivec2(0, 1)));
+	if (dot(n, n) == 0.0)
+		return;
+	n = normalize(n);
+	// the camera centre is where w = 0
+	vec4 eye = inverse_mvp*vec4(0.0, 0.0, depth_ab.y, 0.0);
+	vec3 view = eye.w != 0.0 ? eye.xyz/eye.w - center : -eye.xyz;
+	normal = vec4(dot(n, view) < 0.0 ? -n : n, 0.0);
+}
@@ -0,0 +1,10 @@
+#version 450 core
+// --target depth: no colour attachment, the depth buffer itself holds depth_f32.frag's
+// value. Written linearly instead of the hyperbolic window z so a DEPTH_COMPONENT32F
+// buffer keeps the precision the png needs at any distance; GL_LESS on it still
+// keeps the nearest point.
+in vec4 vpos;
+
+void main(){
+	gl_FragDepth = vpos.z/1000.0;
+}
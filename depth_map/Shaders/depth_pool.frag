@@ -0,0 +1,25 @@
+#version 450 core
+// Min-pools the R16UI depth image into a smaller level: every output pixel keeps the
+// nearest surface among the source pixels it covers, 0 (no point) only if all are 0.
+
+uniform usampler2D src;
+// source pixels per output pixel, per axis
+uniform vec2 ratio;
+
+layout(location = 0) out uint depth;
+
+void main(){
+	ivec2 size = textureSize(src, 0);
+	vec2 p = floor(gl_FragCoord.xy);
+	ivec2 lo = ivec2(floor(p*ratio));
+	ivec2 hi = min(ivec2(ceil((p + 1.0)*ratio)), size);
+	uint d = 0xffffffffu;
+	for (int y = lo.y; y < hi.y; y++)
+		for (int x = lo.x; x < hi.x; x++)
+		{
+			uint v = texelFetch(src, ivec2(x, y), 0).r;
+			if (v != 0u)
+				d = min(d, v);
+		}
+	depth = d == 0xffffffffu ? 0u : d;
+}
@@ -0,0 +1,24 @@
+#version 450 core
+// depth_pool.frag for the R32F target of --dtype f32
+
+uniform sampler2D src;
+// source pixels per output pixel, per axis
+uniform vec2 ratio;
+
+layout(location = 0) out float depth;
+
+void main(){
+	ivec2 size = textureSize(src, 0);
+	vec2 p = floor(gl_FragCoord.xy);
+	ivec2 lo = ivec2(floor(p*ratio));
+	ivec2 hi = min(ivec2(ceil((p + 1.0)*ratio)), size);
+	float d = 0.0;
+	for (int y = lo.y; y < hi.y; y++)
+		for (int x = lo.x; x < hi.x; x++)
+		{
+			float v = texelFetch(src, ivec2(x, y), 0).r;
+			if (v != 0.0 && (d == 0.0 || v < d))
+				d = v;
+		}
+	depth = d;
+}
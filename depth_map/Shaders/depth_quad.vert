@@ -0,0 +1,17 @@
+#version 450 core
+// Instanced path of depth.vert/geo (--splat instanced): one instance per point, its
+// 4 vertices are the corners of the triangle strip depth.geo's draw() would emit.
+layout(location = 0) in vec3 vpos_modelspace;   // per instance
+layout(location = 1) in vec2 corner;            // per vertex, -1 or 1 on each axis
+
+out vec4 vpos;
+flat out uint point_id;
+
+uniform mat4 MVP;
+uniform float patchsize;
+
+void main(){
+  vpos = MVP * vec4(vpos_modelspace,1) + vec4(corner*patchsize, 0.0, 0.0);
+  gl_Position = vpos;
+  point_id = uint(gl_InstanceID);
+}
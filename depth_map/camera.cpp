@@ -0,0 +1,139 @@
+#include "camera.h"
+#include "progress.h"
+
+#include <json/json.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+camera_store::camera_store()
+    : calib_time(-1)
+{
+}
+
+bool camera_store::load(const std::string& calib_filename)
+{
+    // a long running --serve process sees calibrations change under the same name
+    long long t = file_mtime(calib_filename);
+    if (calib_filename == calib_name && t == calib_time)
+        return true;
+
+    printf("loading %s\n", calib_filename.c_str());
+    calib_name.clear();
+    cameras.clear();
+    Json::Value root;
+    Json::Reader reader;
+    std::ifstream file(calib_filename, std::ifstream::binary);
+    if(!reader.parse(file, root, true)){
+        std::cout  << "Failed to parse configuration\n"
+            << reader.getFormattedErrorMessages();
+        return false;
+    }
+    const Json::Value json_cameras = root["cameras"];
+    for (int i = 0; i < (int)json_cameras.size(); i++)
+    {
+        const Json::Value& c = json_cameras[i];
+        int pidx, cidx;
+        if (sscanf(c["name"].asCString(), "%02d_%02d", &pidx, &cidx) != 2)
+            continue;
+        depth_camera& cam = cameras[pidx*100+cidx];
+        for (int r = 0; r < 3; r++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                cam.K[r][k] = c["K"][r][k].asFloat();
+                cam.R[r][k] = c["R"][r][k].asFloat();
+            }
+            cam.t[r] = c["t"][r][0].asFloat();
+        }
+    }
+    calib_name = calib_filename;
+    calib_time = t;
+    return true;
+}
+
+const depth_camera* camera_store::find(int panel, int camera) const
+{
+    std::map<int, depth_camera>::const_iterator it = cameras.find(panel*100+camera);
+    return it == cameras.end() ? NULL : &it->second;
+}
+
+std::vector<int> camera_store::numbers() const
+{
+    std::vector<int> n;
+    for (std::map<int, depth_camera>::const_iterator it = cameras.begin(); it != cameras.end(); ++it)
+        n.push_back(it->first);
+    return n;
+}
+
+glm::mat4 getMVP(const depth_camera& camera, int width, int height, float scale)
+{
+    GLfloat near = 0.1f;
+    GLfloat far = 1000.0f;
+    glm::mat4 Projection, View;
+    {
+        float fx = camera.K[0][0]*scale;
+        float fy = camera.K[1][1]*scale;
+        float cx = camera.K[0][2]*scale;
+        float cy = camera.K[1][2]*scale;
+        float RT_float[16] = {0.0f};
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 3; j++)
+            {
+                RT_float[i*4+j] = camera.R[i][j];
+            }
+            RT_float[i*4+3] = camera.t[i];
+        }
+        RT_float[15] = 1.0f;
+
+
+        //float fx = 1396.52f;
+        //float fy = 1393.52f;
+        //float cx = 933.738f;
+        //float cy = 560.443f;
+        //
+        //float RT_float[16] = {
+        //    -0.9225427896f,-0.01123881405f, -0.3857311115f, -10.70728522f,
+        //    -0.02283482308f, 0.999414139f, 0.02549411087f, 143.7188498f,
+        //    0.3852186031f, 0.03232750985f, -0.9222589441f, 277.0709018f,
+        //    0.0f, 0.0f, 0.0f, 1.0f
+        //};
+
+        float w = (float)width;
+        float h = (float)height;
+
+        // b and t are swapped with respect to the image convention (v grows downwards):
+        // image row 0 lands on framebuffer row 0, so glReadPixels returns rows top-down
+        // and no cv::flip is needed after readback
+        float l = 0.0, r = 1.0*w, b = 0.0, t = 1.0*h;
+        float tx = -(r+l)/(r-l), ty = -(t+b)/(t-b), tz = -(far+near)/(far-near);
+        float ortho_float[16] = {2.0/(r-l), 0.0, 0.0, tx,
+            0.0, 2.0/(t-b), 0.0, ty,
+            0.0, 0.0, -2.0/(far-near), tz,
+            0.0, 0.0, 0.0, 1.0};
+        float Intrinsic_float[16] = {fx, 0, cx, 0.0,
+            0.0, fy, cy, 0.0,
+            0.0, 0.0, -(near+far), +near*far,
+            0.0, 0.0, 1.0 , 0.0};
+        glm::mat4 ortho = glm::make_mat4(ortho_float);
+        glm::mat4 Intrinsic = glm::make_mat4(Intrinsic_float);
+
+        ortho = glm::transpose(ortho);
+        Intrinsic = glm::transpose(Intrinsic);
+
+        Projection = ortho*Intrinsic;
+
+        glm::mat4 RT = glm::transpose(glm::make_mat4(RT_float));
+        View = RT;
+    }
+
+    // Model matrix : an identity matrix (model will be at the origin)
+    glm::mat4 Model = glm::mat4(1.0f);
+    // Our ModelViewProjection : multiplication of our 3 matrices
+    glm::mat4 mvp = Projection * View * Model; // Remember, matrix multiplication is the other way around
+
+    return mvp;
+}
+
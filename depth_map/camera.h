@@ -0,0 +1,44 @@
+#ifndef __CAMERA_H__
+#define __CAMERA_H__
+
+// Include GLEW. Always include it before gl.h and glfw.h, since it's a bit magic.
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <string>
+#include <map>
+#include <vector>
+
+// one calibrated camera of the 1920x1080 rig, x_image ~ K (R x + t)
+struct depth_camera
+{
+    float K[3][3];
+    float R[3][3];
+    float t[3];
+};
+
+// Cameras of a calibration json ({"cameras": [{"name": "00_01", "K", "R", "t"}, ...]})
+// by panel and camera number. load() is free while the same unchanged file is loaded.
+class camera_store
+{
+public:
+    camera_store();
+
+    bool load(const std::string& calib_filename);
+    // NULL if the calibration has no such camera
+    const depth_camera* find(int panel, int camera) const;
+    // panel*100 + camera of every camera, ascending
+    std::vector<int> numbers() const;
+
+private:
+    std::string calib_name;
+    long long calib_time;
+    std::map<int, depth_camera> cameras;
+};
+
+// projection for a width x height render with intrinsics scaled by scale; rows come
+// out top-down and z is the camera space depth
+glm::mat4 getMVP(const depth_camera& camera, int width, int height, float scale);
+
+#endif
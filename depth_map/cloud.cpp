@@ -0,0 +1,151 @@
+#include "cloud.h"
+#include "progress.h"
+
+#include "../3rdparty/rply-1.1.4/rply.h"
+
+#include <cstdio>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+
+// every worker reads into its own buffer, passed to the callback as user data
+static int vertex_cb(p_ply_argument argument) {
+    long eol;
+    void* pdata;
+    ply_get_argument_user_data(argument, &pdata, &eol);
+    //printf("%g", ply_get_argument_value(argument));
+    ((std::vector<GLfloat>*)pdata)->push_back((float)ply_get_argument_value(argument));
+    return 1;
+}
+
+// reads all vertices as xyz triples, unfiltered
+int read_ply(const char* ply_filename, std::vector<GLfloat>& points)
+{
+    points.clear();
+    long nvertices, ntriangles;
+    p_ply ply = ply_open(ply_filename, NULL, 0, NULL);
+    if (!ply) return -1;
+    if (!ply_read_header(ply)) { ply_close(ply); return -1; }
+    nvertices = ply_set_read_cb(ply, "vertex", "x", vertex_cb, &points, 0);
+    ply_set_read_cb(ply, "vertex", "y", vertex_cb, &points, 0);
+    ply_set_read_cb(ply, "vertex", "z", vertex_cb, &points, 1);
+    ntriangles = ply_set_read_cb(ply, "face", "vertex_indices", NULL, NULL, 0);
+    //printf("%ld\n%ld\n", nvertices, ntriangles);
+    points.reserve(3*nvertices);
+    if (!ply_read(ply)) { ply_close(ply); return -1; }
+    ply_close(ply);
+    return 0;
+}
+
+// region of interest: below y = -5, within sqrt(45000) of the y axis
+const float roi_max_y = -5.0f;
+const float roi_max_r2 = 45000.0f;
+
+// keeps the points of the region of interest
+void filter_points(const std::vector<GLfloat>& raw, std::vector<GLfloat>& points)
+{
+    filter_points(raw.empty() ? NULL : &raw[0], raw.size()/3, points);
+}
+
+void filter_points(const GLfloat* raw, size_t count, std::vector<GLfloat>& points)
+{
+    points.clear();
+    for (size_t i=0; i<3*count; i+=3)
+    {
+        if (raw[i+1]<roi_max_y && (raw[i]*raw[i]+raw[i+2]*raw[i+2])<roi_max_r2)
+        {
+            points.push_back(raw[i]);
+            points.push_back(raw[i+1]);
+            points.push_back(raw[i+2]);
+        }
+    }
+}
+
+void filter_points(const std::vector<GLfloat>& raw, std::vector<GLfloat>& points, std::vector<int>& vertices)
+{
+    points.clear();
+    vertices.clear();
+    for (size_t i=0; i<raw.size(); i+=3)
+    {
+        if (raw[i+1]<roi_max_y && (raw[i]*raw[i]+raw[i+2]*raw[i+2])<roi_max_r2)
+        {
+            points.push_back(raw[i]);
+            points.push_back(raw[i+1]);
+            points.push_back(raw[i+2]);
+            vertices.push_back((int)(i/3));
+        }
+    }
+}
+
+// cell of every point, 21 bits per axis, sorted with the point index
+static void grid_cells(const std::vector<GLfloat>& points, const float lo[3], float cell,
+    std::vector<std::pair<uint64_t, uint32_t> >& cells)
+{
+    size_t n = points.size()/3;
+    cells.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t key = 0;
+        for (int k = 0; k < 3; k++)
+            key = key << 21 | (uint64_t)std::min((points[3*i+k] - lo[k])/cell, 2097151.0f);
+        cells[i] = std::make_pair(key, (uint32_t)i);
+    }
+    std::sort(cells.begin(), cells.end());
+}
+
+void point_spacing(const std::vector<GLfloat>& points, std::vector<GLfloat>& spacing)
+{
+    const float per_cell = 16.0f;
+    size_t n = points.size()/3;
+    spacing.assign(n, 0.0f);
+    if (n == 0)
+        return;
+
+    float lo[3], hi[3];
+    for (int k = 0; k < 3; k++)
+        lo[k] = hi[k] = points[k];
+    for (size_t i = 0; i < n; i++)
+        for (int k = 0; k < 3; k++)
+        {
+            lo[k] = std::min(lo[k], points[3*i+k]);
+            hi[k] = std::max(hi[k], points[3*i+k]);
+        }
+    float extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    if (extent <= 0.0f)
+        return;
+
+    // start as if the points filled their bounding cube, then rescale twice assuming
+    // they lie on surfaces, where the count per cell grows with the cell's area
+    float cell = extent/std::pow((float)n/per_cell, 1.0f/3.0f);
+    std::vector<std::pair<uint64_t, uint32_t> > cells;
+    for (int iteration = 0; ; iteration++)
+    {
+        cell = std::max(cell, extent/2097151.0f);
+        grid_cells(points, lo, cell, cells);
+        if (iteration == 2)
+            break;
+        size_t occupied = 1;
+        for (size_t i = 1; i < n; i++)
+            occupied += cells[i].first != cells[i-1].first;
+        float mean = (float)n/occupied;
+        cell *= std::min(4.0f, std::max(0.25f, std::sqrt(per_cell/mean)));
+    }
+
+    for (size_t begin = 0, end; begin < n; begin = end)
+    {
+        for (end = begin + 1; end < n && cells[end].first == cells[begin].first; end++)
+            ;
+        float s = cell/std::sqrt((float)(end - begin));
+        for (size_t i = begin; i < end; i++)
+            spacing[cells[i].second] = s;
+    }
+}
+
+// gpu cache key: the same file under another filter, or rewritten since, is another cloud
+std::string cloud_key(const std::string& ply_name)
+{
+    char filter[96];
+    sprintf(filter, "|y<%g|r2<%g|%lld", roi_max_y, roi_max_r2, file_mtime(ply_name));
+    return ply_name + filter;
+}
@@ -0,0 +1,28 @@
+#ifndef __CLOUD_H__
+#define __CLOUD_H__
+
+// Include GLEW. Always include it before gl.h and glfw.h, since it's a bit magic.
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+
+// region of interest: below y = -5, within sqrt(45000) of the y axis
+extern const float roi_max_y;
+extern const float roi_max_r2;
+
+// reads all vertices of a ply as xyz triples, unfiltered; 0 on success
+int read_ply(const char* ply_filename, std::vector<GLfloat>& points);
+// keeps the points of the region of interest
+void filter_points(const std::vector<GLfloat>& raw, std::vector<GLfloat>& points);
+void filter_points(const GLfloat* raw, size_t count, std::vector<GLfloat>& points);
+// also records the ply vertex index of every kept point
+void filter_points(const std::vector<GLfloat>& raw, std::vector<GLfloat>& points, std::vector<int>& vertices);
+// local sampling distance around every point, in world units, for adaptive splats:
+// points are bucketed into a grid sized so that an occupied cell holds about 16 of
+// them, and n points on a surface through a cell of size c are about c/sqrt(n) apart
+void point_spacing(const std::vector<GLfloat>& points, std::vector<GLfloat>& spacing);
+// gpu cache key: the same file under another filter, or rewritten since, is another cloud
+std::string cloud_key(const std::string& ply_name);
+
+#endif
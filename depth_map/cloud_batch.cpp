@@ -0,0 +1,131 @@
+#include "cloud_batch.h"
+#include "cloud.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+cloud_batch::cloud_batch()
+    : vbo(0), draw_id_buffer(0), command_buffer(0), model_buffer(0)
+{
+}
+
+cloud_batch::~cloud_batch()
+{
+    // buffers are gone with their context if clear() was not called
+}
+
+void cloud_batch::add(const GLfloat* points, size_t count, const glm::mat4& model)
+{
+    range r;
+    r.first = (GLuint)(xyz.size()/3);
+    r.count = (GLuint)count;
+    xyz.insert(xyz.end(), points, points + 3*count);
+    ranges.push_back(r);
+    models.push_back(model);
+}
+
+bool cloud_batch::upload()
+{
+    if (!GLEW_VERSION_4_3 && !(GLEW_ARB_multi_draw_indirect && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_base_instance))
+    {
+        fprintf(stderr, "scenes need GL 4.3 multi draw indirect\n");
+        return false;
+    }
+    if (!vbo)
+    {
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &draw_id_buffer);
+        glGenBuffers(1, &command_buffer);
+        glGenBuffers(1, &model_buffer);
+    }
+
+    // DrawArraysIndirectCommand: count, instanceCount, first, baseInstance
+    std::vector<GLuint> commands(4*ranges.size()), draw_ids(ranges.size());
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        commands[4*i] = ranges[i].count;
+        commands[4*i + 1] = 1;
+        commands[4*i + 2] = ranges[i].first;
+        commands[4*i + 3] = (GLuint)i;
+        draw_ids[i] = (GLuint)i;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*xyz.size(), xyz.empty() ? NULL : &xyz[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, draw_id_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint)*draw_ids.size(), draw_ids.empty() ? NULL : &draw_ids[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(GLuint)*commands.size(), commands.empty() ? NULL : &commands[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    // glm is column-major like std430 mat4
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, model_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::mat4)*models.size(), models.empty() ? NULL : &models[0][0][0], GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return glGetError() != GL_OUT_OF_MEMORY;
+}
+
+void cloud_batch::clear()
+{
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &draw_id_buffer);
+    glDeleteBuffers(1, &command_buffer);
+    glDeleteBuffers(1, &model_buffer);
+    vbo = draw_id_buffer = command_buffer = model_buffer = 0;
+    xyz.clear();
+    ranges.clear();
+    models.clear();
+}
+
+bool is_scene(const std::string& name)
+{
+    return name.size() > 6 && name.compare(name.size() - 6, 6, ".scene") == 0;
+}
+
+int read_scene(const std::string& scene_name, cloud_batch& batch, long long& points_loaded)
+{
+    std::ifstream in(scene_name.c_str());
+    if (!in.is_open())
+        return -1;
+    size_t slash = scene_name.find_last_of("/\\");
+    std::string dir = slash == std::string::npos ? std::string() : scene_name.substr(0, slash + 1);
+
+    points_loaded = 0;
+    std::vector<GLfloat> raw, points;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string ply;
+        if (!(fields >> ply) || ply[0] == '#')
+            continue;
+        float m[16];
+        int n = 0;
+        while (n < 16 && fields >> m[n])
+            n++;
+        if (n != 0 && n != 16)
+        {
+            fprintf(stderr, "%s: %s needs 0 or 16 matrix values\n", scene_name.c_str(), ply.c_str());
+            return -1;
+        }
+        // rows in the file, glm wants columns
+        glm::mat4 model(1.0f);
+        if (n == 16)
+            model = glm::transpose(glm::make_mat4(m));
+
+        bool absolute = ply[0] == '/' || ply[0] == '\\' || (ply.size() > 1 && ply[1] == ':');
+        std::string path = absolute ? ply : dir + ply;
+        if (read_ply(path.c_str(), raw))
+        {
+            fprintf(stderr, "Failed to read file %s\n", path.c_str());
+            return -1;
+        }
+        points_loaded += raw.size()/3;
+        filter_points(raw, points);
+        batch.add(points.empty() ? NULL : &points[0], points.size()/3, model);
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef __CLOUD_BATCH_H__
+#define __CLOUD_BATCH_H__
+
+// Include GLEW. Always include it before gl.h and glfw.h, since it's a bit magic.
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// Many small clouds (per-subject segments, per-frame snippets) rendered together for
+// one camera. Their points are suballocated back to back in one buffer and each cloud
+// is one command of a single glMultiDrawArraysIndirect: its (first, count) range, and
+// its index as baseInstance. The model matrices sit at those indices of an SSBO;
+// depth_multi.vert reads the index from an attribute with divisor 1, which starts at
+// baseInstance, so no ARB_shader_draw_parameters is needed. GL 4.3.
+//
+// Clouds are added on the cpu and uploaded together; the buffers belong to the context
+// current at upload, like cloud_cache's.
+class cloud_batch
+{
+public:
+    // one cloud, as in the indirect command
+    struct range
+    {
+        GLuint first, count;
+    };
+
+    cloud_batch();
+    ~cloud_batch();
+
+    // appends count points (xyz triples) that model maps into the world
+    void add(const GLfloat* xyz, size_t count, const glm::mat4& model);
+    size_t clouds() const { return ranges.size(); }
+    size_t points() const { return xyz.size()/3; }
+    const std::vector<range>& cloud_ranges() const { return ranges; }
+    const GLfloat* cloud_points(size_t i) const { return &xyz[3*(size_t)ranges[i].first]; }
+
+    // copies everything added into the gl buffers, replacing what they held
+    bool upload();
+    // deletes the gl buffers and forgets the clouds, needs the context current
+    void clear();
+
+    // after upload: points (attribute 0), draw indices 0..n-1 (attribute 2, divisor 1),
+    // indirect commands and model matrices (std430 mat4 array)
+    GLuint vbo, draw_id_buffer, command_buffer, model_buffer;
+
+private:
+    std::vector<GLfloat> xyz;
+    std::vector<range> ranges;
+    std::vector<glm::mat4> models;
+};
+
+// Scene file for cloud_batch, the ply column of a job when it ends in .scene: one cloud
+// per line, a ply (relative to the scene's directory) optionally followed by its model
+// matrix as 16 numbers, row by row; identity without. Blank lines and # comments are
+// skipped. Every ply is filtered (cloud.h) in its own frame. 0 on success.
+int read_scene(const std::string& scene_name, cloud_batch& batch, long long& points_loaded);
+bool is_scene(const std::string& name);
+
+#endif
@@ -0,0 +1,72 @@
+#include "cloud_cache.h"
+
+cloud_cache::cloud_cache(size_t budget_bytes)
+    : hits(0), misses(0), evictions(0), resident_bytes(0), peak_bytes(0), budget(budget_bytes)
+{
+}
+
+cloud_cache::~cloud_cache()
+{
+    // buffers are gone with their context if clear() was not called
+}
+
+const cloud_cache::cloud* cloud_cache::find(const std::string& key)
+{
+    std::map<std::string, entry>::iterator it = clouds.find(key);
+    if (it == clouds.end())
+    {
+        misses++;
+        return NULL;
+    }
+    hits++;
+    lru.splice(lru.begin(), lru, it->second.lru);
+    return &it->second.c;
+}
+
+const cloud_cache::cloud* cloud_cache::insert(const std::string& key, const std::vector<GLfloat>& points, long long points_loaded)
+{
+    size_t bytes = sizeof(GLfloat)*points.size();
+    if (bytes == 0 || bytes > budget)
+        return NULL;
+
+    while (resident_bytes + bytes > budget && !lru.empty())
+    {
+        std::map<std::string, entry>::iterator victim = clouds.find(lru.back());
+        glDeleteBuffers(1, &victim->second.c.buffer);
+        resident_bytes -= victim->second.bytes;
+        clouds.erase(victim);
+        lru.pop_back();
+        evictions++;
+    }
+
+    entry e;
+    e.bytes = bytes;
+    e.c.count = (GLsizei)(points.size()/3);
+    e.c.points_loaded = points_loaded;
+    glGenBuffers(1, &e.c.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, e.c.buffer);
+    // immutable and never written again: no flags, the driver may keep it in vram only
+    glBufferStorage(GL_ARRAY_BUFFER, bytes, &points[0], 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (glGetError() == GL_OUT_OF_MEMORY)
+    {
+        glDeleteBuffers(1, &e.c.buffer);
+        return NULL;
+    }
+
+    lru.push_front(key);
+    e.lru = lru.begin();
+    resident_bytes += bytes;
+    if (resident_bytes > peak_bytes)
+        peak_bytes = resident_bytes;
+    return &(clouds[key] = e).c;
+}
+
+void cloud_cache::clear()
+{
+    for (std::map<std::string, entry>::iterator it = clouds.begin(); it != clouds.end(); ++it)
+        glDeleteBuffers(1, &it->second.c.buffer);
+    clouds.clear();
+    lru.clear();
+    resident_bytes = 0;
+}
@@ -0,0 +1,54 @@
+#ifndef __CLOUD_CACHE_H__
+#define __CLOUD_CACHE_H__
+
+// Include GLEW. Always include it before gl.h and glfw.h, since it's a bit magic.
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+
+// Filtered point clouds kept on the gpu between jobs, so a cloud that comes back later
+// in the list is neither parsed nor uploaded again. Every cloud lives in its own
+// immutable buffer (glBufferStorage); when the next one does not fit the budget the
+// least recently used clouds are deleted first. Buffers belong to the context that was
+// current at insert, so each render thread has its own cache.
+class cloud_cache
+{
+public:
+    struct cloud
+    {
+        GLuint buffer;
+        GLsizei count;             // points in buffer, xyz floats each
+        long long points_loaded;   // before filtering, for the stats
+    };
+
+    explicit cloud_cache(size_t budget_bytes);
+    ~cloud_cache();
+
+    // NULL if key is not resident; a hit makes it the most recently used
+    const cloud* find(const std::string& key);
+    // uploads points under key, evicting as needed; NULL if the cache is off or the cloud
+    // alone exceeds the budget, the caller then renders from memory
+    const cloud* insert(const std::string& key, const std::vector<GLfloat>& points, long long points_loaded);
+    // deletes every buffer, needs the context current
+    void clear();
+
+    long hits, misses, evictions;
+    size_t resident_bytes, peak_bytes;
+
+private:
+    struct entry
+    {
+        cloud c;
+        size_t bytes;
+        std::list<std::string>::iterator lru;
+    };
+
+    size_t budget;
+    std::map<std::string, entry> clouds;
+    std::list<std::string> lru;   // most recently used first
+};
+
+#endif
@@ -0,0 +1,381 @@
+#include "context.h"
+
+// Include GLEW. Always include it before gl.h and glfw.h, since it's a bit magic.
+#include <GL/glew.h>
+
+#ifdef DEPTH_MAP_WITH_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef DEPTH_MAP_WITH_OSMESA
+#include <GL/osmesa.h>
+#endif
+#ifndef DEPTH_MAP_NO_GLFW
+#include <GLFW/glfw3.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+static gl_backend current_backend;
+
+#ifdef DEPTH_MAP_WITH_EGL
+
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLConfig egl_config;
+static bool egl_surfaceless = false;
+
+class egl_context : public gl_context
+{
+public:
+    egl_context(EGLContext ctx, EGLSurface surface) : ctx(ctx), surface(surface) {}
+    ~egl_context()
+    {
+        if (surface != EGL_NO_SURFACE)
+            eglDestroySurface(egl_display, surface);
+        eglDestroyContext(egl_display, ctx);
+    }
+    bool make_current()
+    {
+        // the bound api is per thread
+        eglBindAPI(EGL_OPENGL_API);
+        return eglMakeCurrent(egl_display, surface, surface, ctx) == EGL_TRUE;
+    }
+    void release()
+    {
+        eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+private:
+    EGLContext ctx;
+    EGLSurface surface;
+};
+
+static bool egl_init()
+{
+    // prefer mesa's surfaceless platform, it needs neither an X server nor a gpu device node,
+    // then the first EGL device, which is how headless nvidia drivers expose the gpu
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    const char* client_ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (get_platform_display && client_ext && strstr(client_ext, "EGL_MESA_platform_surfaceless"))
+        egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (egl_display == EGL_NO_DISPLAY && get_platform_display && client_ext && strstr(client_ext, "EGL_EXT_platform_device"))
+    {
+        PFNEGLQUERYDEVICESEXTPROC query_devices =
+            (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+        EGLDeviceEXT device;
+        EGLint num_devices = 0;
+        if (query_devices && query_devices(1, &device, &num_devices) && num_devices > 0)
+            egl_display = get_platform_display(EGL_PLATFORM_DEVICE_EXT, device, NULL);
+    }
+    if (egl_display == EGL_NO_DISPLAY)
+        egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, NULL, NULL))
+    {
+        fprintf(stderr, "Failed to initialize EGL\n");
+        egl_display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    const char* ext = eglQueryString(egl_display, EGL_EXTENSIONS);
+    egl_surfaceless = ext && strstr(ext, "EGL_KHR_surfaceless_context");
+
+    // no samples, depth or stencil, the surface (if any) is never rendered to
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, egl_surfaceless ? 0 : EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_SAMPLES, 0,
+        EGL_DEPTH_SIZE, 0,
+        EGL_STENCIL_SIZE, 0,
+        EGL_NONE
+    };
+    EGLint num_configs = 0;
+    if (!eglChooseConfig(egl_display, config_attribs, &egl_config, 1, &num_configs) || num_configs < 1)
+    {
+        fprintf(stderr, "No EGL config supports desktop OpenGL\n");
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        fprintf(stderr, "EGL cannot bind the OpenGL api\n");
+        return false;
+    }
+    return true;
+}
+
+static gl_context* egl_create()
+{
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 4,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext ctx = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, context_attribs);
+    if (ctx == EGL_NO_CONTEXT)
+    {
+        fprintf(stderr, "Failed to create an OpenGL 4.4 core EGL context\n");
+        return NULL;
+    }
+    EGLSurface surface = EGL_NO_SURFACE;
+    if (!egl_surfaceless)
+    {
+        // never drawn to, the renderer uses its own fbo
+        const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        surface = eglCreatePbufferSurface(egl_display, egl_config, pbuffer_attribs);
+        if (surface == EGL_NO_SURFACE)
+        {
+            fprintf(stderr, "Failed to create an EGL pbuffer\n");
+            eglDestroyContext(egl_display, ctx);
+            return NULL;
+        }
+    }
+    return new egl_context(ctx, surface);
+}
+
+static void egl_terminate()
+{
+    eglTerminate(egl_display);
+    egl_display = EGL_NO_DISPLAY;
+}
+
+#endif
+
+#ifndef DEPTH_MAP_NO_GLFW
+
+class glfw_context : public gl_context
+{
+public:
+    glfw_context(GLFWwindow* window) : window(window) {}
+    ~glfw_context()
+    {
+        glfwDestroyWindow(window);
+    }
+    bool make_current()
+    {
+        glfwMakeContextCurrent(window);
+        return true;
+    }
+    void release()
+    {
+        glfwMakeContextCurrent(NULL);
+    }
+private:
+    GLFWwindow* window;
+};
+
+static bool glfw_init()
+{
+    // Initialise GLFW
+    if (!glfwInit())
+    {
+        fprintf(stderr, "Failed to initialize GLFW\n");
+        return false;
+    }
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); 
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); //We don't want the old OpenGL 
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    // the window's framebuffer is never drawn to, keep it as small as the driver allows
+    glfwWindowHint(GLFW_SAMPLES, 0);
+    glfwWindowHint(GLFW_DEPTH_BITS, 0);
+    glfwWindowHint(GLFW_STENCIL_BITS, 0);
+    return true;
+}
+
+static gl_context* glfw_create()
+{
+    // Open a window and create its OpenGL context, the renderer has its own fbo so 1x1 is enough
+    GLFWwindow* window = glfwCreateWindow(1, 1, "depth", NULL, NULL);
+    if (window == NULL) {
+        fprintf(stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n");
+        return NULL;
+    }
+    return new glfw_context(window);
+}
+
+static void glfw_terminate()
+{
+    // Terminate GLFW, clearing any resources allocated by GLFW.
+    glfwTerminate();
+}
+
+#endif
+
+#ifdef DEPTH_MAP_WITH_OSMESA
+
+class osmesa_context : public gl_context
+{
+public:
+    osmesa_context(OSMesaContext ctx) : ctx(ctx) {}
+    ~osmesa_context()
+    {
+        OSMesaDestroyContext(ctx);
+    }
+    bool make_current()
+    {
+        // osmesa always wants a color buffer, it is never rendered to
+        return OSMesaMakeCurrent(ctx, pixel, GL_UNSIGNED_BYTE, 1, 1) == GL_TRUE;
+    }
+    void release()
+    {
+        OSMesaMakeCurrent(NULL, NULL, 0, 0, 0);
+    }
+private:
+    OSMesaContext ctx;
+    GLubyte pixel[4];
+};
+
+static gl_context* osmesa_create()
+{
+    const int attribs[] = {
+        OSMESA_FORMAT, OSMESA_RGBA,
+        OSMESA_DEPTH_BITS, 0,
+        OSMESA_STENCIL_BITS, 0,
+        OSMESA_ACCUM_BITS, 0,
+        OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, 4,
+        OSMESA_CONTEXT_MINOR_VERSION, 4,
+        0
+    };
+    OSMesaContext ctx = OSMesaCreateContextAttribs(attribs, NULL);
+    if (!ctx)
+    {
+        fprintf(stderr, "Failed to create an OpenGL 4.4 core OSMesa context\n");
+        return NULL;
+    }
+    return new osmesa_context(ctx);
+}
+
+#endif
+
+bool parse_gl_backend(const char* s, gl_backend& backend)
+{
+    std::string name = s;
+#ifndef DEPTH_MAP_NO_GLFW
+    if (name == "glfw")
+    {
+        backend = GL_BACKEND_GLFW;
+        return true;
+    }
+#endif
+#ifdef DEPTH_MAP_WITH_EGL
+    if (name == "egl")
+    {
+        backend = GL_BACKEND_EGL;
+        return true;
+    }
+#endif
+#ifdef DEPTH_MAP_WITH_OSMESA
+    if (name == "osmesa")
+    {
+        backend = GL_BACKEND_OSMESA;
+        return true;
+    }
+#endif
+    return false;
+}
+
+gl_backend default_gl_backend()
+{
+#if defined(DEPTH_MAP_WITH_EGL)
+    return GL_BACKEND_EGL;
+#elif !defined(DEPTH_MAP_NO_GLFW)
+    return GL_BACKEND_GLFW;
+#elif defined(DEPTH_MAP_WITH_OSMESA)
+    return GL_BACKEND_OSMESA;
+#else
+#error depth_map needs at least one context backend
+#endif
+}
+
+const char* gl_backend_name(gl_backend backend)
+{
+    switch (backend)
+    {
+    case GL_BACKEND_GLFW: return "glfw";
+    case GL_BACKEND_EGL: return "egl";
+    case GL_BACKEND_OSMESA: return "osmesa";
+    }
+    return "unknown";
+}
+
+bool init_gl_platform(gl_backend backend)
+{
+    current_backend = backend;
+    switch (backend)
+    {
+#ifndef DEPTH_MAP_NO_GLFW
+    case GL_BACKEND_GLFW: return glfw_init();
+#endif
+#ifdef DEPTH_MAP_WITH_EGL
+    case GL_BACKEND_EGL: return egl_init();
+#endif
+#ifdef DEPTH_MAP_WITH_OSMESA
+    case GL_BACKEND_OSMESA: return true;
+#endif
+    default: break;
+    }
+    fprintf(stderr, "depth_map was built without the %s backend\n", gl_backend_name(backend));
+    return false;
+}
+
+gl_context* create_gl_context()
+{
+    switch (current_backend)
+    {
+#ifndef DEPTH_MAP_NO_GLFW
+    case GL_BACKEND_GLFW: return glfw_create();
+#endif
+#ifdef DEPTH_MAP_WITH_EGL
+    case GL_BACKEND_EGL: return egl_create();
+#endif
+#ifdef DEPTH_MAP_WITH_OSMESA
+    case GL_BACKEND_OSMESA: return osmesa_create();
+#endif
+    default: break;
+    }
+    return NULL;
+}
+
+void terminate_gl_platform()
+{
+    switch (current_backend)
+    {
+#ifndef DEPTH_MAP_NO_GLFW
+    case GL_BACKEND_GLFW: glfw_terminate(); break;
+#endif
+#ifdef DEPTH_MAP_WITH_EGL
+    case GL_BACKEND_EGL: egl_terminate(); break;
+#endif
+    default: break;
+    }
+}
+
+// glewInit fills process wide function pointers, render threads call it at once. File
+// scope: VS2012 does not make the construction of function statics thread safe
+static std::mutex glew_mutex;
+
+bool init_glew()
+{
+    std::lock_guard<std::mutex> lock(glew_mutex);
+
+    glewExperimental = true; // Needed in core profile
+    GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // a glx build of glew still loads every entry point, it only misses the glx display
+    if (err == GLEW_ERROR_NO_GLX_DISPLAY)
+        err = GLEW_OK;
+#endif
+    if (err != GLEW_OK) {
+        fprintf(stderr, "Failed to initialize GLEW\n");
+        return false;
+    }
+    // glewExperimental can leave a harmless GL_INVALID_ENUM behind
+    glGetError();
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef __CONTEXT_H__
+#define __CONTEXT_H__
+
+// Offscreen OpenGL 4.4 core contexts for the render workers. Nothing is ever
+// presented, every context only renders into its own FBO, so none of the backends
+// asks for a multisampled or depth buffered default framebuffer.
+//
+// The backend is picked at runtime from the ones compiled in:
+//  - egl    (DEPTH_MAP_WITH_EGL) contexts without a window, on mesa's surfaceless
+//           platform, an EGL device or the default display, surfaceless or with a 1x1
+//           pbuffer when the driver lacks EGL_KHR_surfaceless_context. Works on
+//           display-less machines and on llvmpipe.
+//  - osmesa (DEPTH_MAP_WITH_OSMESA) mesa's software off-screen contexts, needs a GLEW
+//           built with GLEW_OSMESA.
+//  - glfw   hidden GLFW windows, left out of builds with DEPTH_MAP_NO_GLFW.
+enum gl_backend
+{
+    GL_BACKEND_GLFW,
+    GL_BACKEND_EGL,
+    GL_BACKEND_OSMESA
+};
+
+// accepts "glfw", "egl" or "osmesa", false for unknown names and backends not built in
+bool parse_gl_backend(const char* s, gl_backend& backend);
+// egl if built in, else glfw, else osmesa
+gl_backend default_gl_backend();
+const char* gl_backend_name(gl_backend backend);
+
+class gl_context
+{
+public:
+    virtual ~gl_context() {}
+    // binds the context to the calling thread, a context is current on at most one thread
+    virtual bool make_current() = 0;
+    virtual void release() = 0;
+};
+
+// init_gl_platform, create_gl_context, destroying contexts and terminate_gl_platform
+// must run on the main thread; make_current/release may run on any thread.
+bool init_gl_platform(gl_backend backend);
+gl_context* create_gl_context();
+void terminate_gl_platform();
+
+// glewInit for the context current on this thread; serialized since GLEW's
+// function pointers are process globals
+bool init_glew();
+
+#endif
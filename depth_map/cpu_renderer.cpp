@@ -0,0 +1,356 @@
+#include "cpu_renderer.h"
+#include "project.h"
+
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+static const int tile_size = 64;
+// points deinterleaved and projected at a time, small enough for the stack
+static const int project_block = 256;
+// same as the patchsize uniform of the gl renderer
+static const float patchsize = 0.8f;
+
+static inline float snap(float x)
+{
+    return std::floor(x*256.0f + 0.5f)/256.0f;
+}
+
+// GLSL roundEven; std::nearbyint is C99, missing from the VS2012 CRT. x - floor(x)
+// is exact, unlike floor(x + 0.5) which rounds up the float just below 0.5
+static inline float round_even(float x)
+{
+    float r = std::floor(x);
+    float frac = x - r;
+    if (frac > 0.5f || (frac == 0.5f && std::fmod(r, 2.0f) != 0.0f))
+        r += 1.0f;
+    return r;
+}
+
+// depth.frag: uint(clamp(roundEven(z*10), 0, 65535))
+static inline unsigned short quantize(float z)
+{
+    return (unsigned short)std::min(std::max(round_even(z*10.0f), 0.0f), 65535.0f);
+}
+
+// runs f(0..n-1) on n threads, inline for one
+template <typename F>
+static void parallel(int n, F f)
+{
+    if (n <= 1)
+    {
+        f(0);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < n; t++)
+        threads.push_back(std::thread(f, t));
+    for (auto& t:threads)
+        t.join();
+}
+
+bool parse_cpu_raster(const std::string& name, cpu_raster& mode)
+{
+    if (name == "tiles")
+        mode = CPU_RASTER_TILES;
+    else if (name == "atomic")
+        mode = CPU_RASTER_ATOMIC;
+    else
+        return false;
+    return true;
+}
+
+cpu_renderer::cpu_renderer(int num_threads, cpu_raster mode)
+    : num_threads(num_threads > 0 ? num_threads : 1), mode(mode), width(0), height(0), float_output(false),
+      tiles_x(0), tiles_y(0)
+{
+}
+
+bool cpu_renderer::init(int width, int height, bool float_output)
+{
+    this->width = width;
+    this->height = height;
+    this->float_output = float_output;
+    tiles_x = (width + tile_size - 1)/tile_size;
+    tiles_y = (height + tile_size - 1)/tile_size;
+    if (mode == CPU_RASTER_ATOMIC)
+        nearest.resize(width, height);
+    else
+        bins.assign(num_threads, std::vector<std::vector<splat> >(tiles_x*tiles_y));
+    return true;
+}
+
+void cpu_renderer::destroy()
+{
+    bins.clear();
+    nearest.resize(0, 0);
+    levels.clear();
+    last = cv::Mat();
+    last_ids = cv::Mat();
+}
+
+bool cpu_renderer::make_splat(float sx, float sy, float cz, float cw, splat& s) const
+{
+    // the quad has the point's z and w at every corner: it is either inside the
+    // near/far planes or clipped as a whole
+    if (cw <= 0.0f || cz < -cw || cz > cw)
+        return false;
+
+    // window space square with its corners on the 1/256 pixel grid rasterizers
+    // snap to; pixel centers inside it are covered
+    float rx = patchsize/cw*(0.5f*width), ry = patchsize/cw*(0.5f*height);
+    float left = snap(sx - rx), right = snap(sx + rx);
+    float bottom = snap(sy - ry), top = snap(sy + ry);
+    s.x0 = std::max(0, (int)std::ceil(left - 0.5f));
+    s.x1 = std::min(width, (int)std::ceil(right - 0.5f));
+    s.y0 = std::max(0, (int)std::ceil(bottom - 0.5f));
+    s.y1 = std::min(height, (int)std::ceil(top - 0.5f));
+    if (s.x0 >= s.x1 || s.y0 >= s.y1)
+        return false;
+    s.depth = cz/cw;
+    s.z = cz;
+    return true;
+}
+
+void cpu_renderer::bin(const GLfloat* xyz, size_t begin, size_t end, const glm::mat4& mvp, std::vector<std::vector<splat> >& tiles)
+{
+    for (size_t t = 0; t < tiles.size(); t++)
+        tiles[t].clear();
+
+    float x[project_block], y[project_block], z[project_block];
+    float sx[project_block], sy[project_block], cz[project_block], cw[project_block];
+    for (size_t block = begin; block < end; block += project_block)
+    {
+        size_t n = std::min(end - block, (size_t)project_block);
+        const GLfloat* p = xyz + 3*block;
+        for (size_t i = 0; i < n; i++)
+        {
+            x[i] = p[3*i];
+            y[i] = p[3*i+1];
+            z[i] = p[3*i+2];
+        }
+        project_points(mvp, x, y, z, n, width, height, sx, sy, cz, cw);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            splat s;
+            if (!make_splat(sx[i], sy[i], cz[i], cw[i], s))
+                continue;
+            for (int ty = s.y0/tile_size; ty <= (s.y1-1)/tile_size; ty++)
+                for (int tx = s.x0/tile_size; tx <= (s.x1-1)/tile_size; tx++)
+                    tiles[ty*tiles_x + tx].push_back(s);
+        }
+    }
+}
+
+void cpu_renderer::raster_tile(int tile, cv::Mat& img)
+{
+    int tx0 = (tile % tiles_x)*tile_size, ty0 = (tile / tiles_x)*tile_size;
+    int tx1 = std::min(tx0 + tile_size, width), ty1 = std::min(ty0 + tile_size, height);
+    float depth[tile_size*tile_size];
+    float value[tile_size*tile_size];
+    std::fill(depth, depth + tile_size*tile_size, std::numeric_limits<float>::infinity());
+
+    // slices in cloud order, so the first of equally near splats wins like GL_LESS
+    for (int t = 0; t < num_threads; t++)
+    {
+        const std::vector<splat>& splats = bins[t][tile];
+        for (size_t i = 0; i < splats.size(); i++)
+        {
+            const splat& s = splats[i];
+            int x0 = std::max(s.x0, tx0), x1 = std::min(s.x1, tx1);
+            int y0 = std::max(s.y0, ty0), y1 = std::min(s.y1, ty1);
+            for (int y = y0; y < y1; y++)
+            {
+                float* d = depth + (y-ty0)*tile_size - tx0;
+                float* v = value + (y-ty0)*tile_size - tx0;
+                for (int x = x0; x < x1; x++)
+                {
+                    if (s.depth < d[x])
+                    {
+                        d[x] = s.depth;
+                        v[x] = s.z;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int y = ty0; y < ty1; y++)
+    {
+        const float* d = depth + (y-ty0)*tile_size - tx0;
+        const float* v = value + (y-ty0)*tile_size - tx0;
+        if (float_output)
+        {
+            float* row = img.ptr<float>(y);
+            for (int x = tx0; x < tx1; x++)
+                row[x] = d[x] == std::numeric_limits<float>::infinity() ? 0.0f : v[x]/1000.0f;
+        }
+        else
+        {
+            unsigned short* row = img.ptr<unsigned short>(y);
+            for (int x = tx0; x < tx1; x++)
+                row[x] = d[x] == std::numeric_limits<float>::infinity() ? 0 : quantize(v[x]);
+        }
+    }
+}
+
+void cpu_renderer::splat_slice(const GLfloat* xyz, size_t begin, size_t end, const glm::mat4& mvp)
+{
+    float x[project_block], y[project_block], z[project_block];
+    float sx[project_block], sy[project_block], cz[project_block], cw[project_block];
+    for (size_t block = begin; block < end; block += project_block)
+    {
+        size_t n = std::min(end - block, (size_t)project_block);
+        const GLfloat* p = xyz + 3*block;
+        for (size_t i = 0; i < n; i++)
+        {
+            x[i] = p[3*i];
+            y[i] = p[3*i+1];
+            z[i] = p[3*i+2];
+        }
+        project_points(mvp, x, y, z, n, width, height, sx, sy, cz, cw);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            splat s;
+            if (make_splat(sx[i], sy[i], cz[i], cw[i], s))
+                nearest.splat(s.x0, s.y0, s.x1, s.y1, s.depth, (uint32_t)(block + i));
+        }
+    }
+}
+
+void cpu_renderer::resolve_rows(const GLfloat* xyz, const glm::mat4& mvp, int y0, int y1, cv::Mat& img, cv::Mat& ids)
+{
+    // the buffer only keeps the winner's index, its clip z is projected again
+    // with the same kernel so the value is bit for bit the binned one
+    float x[project_block], y[project_block], z[project_block];
+    float sx[project_block], sy[project_block], cz[project_block], cw[project_block];
+    int pixel[project_block];
+    size_t n = 0;
+    auto flush = [&]
+    {
+        project_points(mvp, x, y, z, n, width, height, sx, sy, cz, cw);
+        for (size_t i = 0; i < n; i++)
+        {
+            if (float_output)
+                img.ptr<float>(0)[pixel[i]] = cz[i]/1000.0f;
+            else
+                img.ptr<unsigned short>(0)[pixel[i]] = quantize(cz[i]);
+        }
+        n = 0;
+    };
+
+    for (int row = y0; row < y1; row++)
+    {
+        int* id = ids.ptr<int>(row);
+        for (int col = 0; col < width; col++)
+        {
+            uint32_t index = nearest.take(col, row);
+            if (index == depth_index_buffer::no_point)
+            {
+                id[col] = -1;
+                if (float_output)
+                    img.ptr<float>(row)[col] = 0.0f;
+                else
+                    img.ptr<unsigned short>(row)[col] = 0;
+                continue;
+            }
+            id[col] = (int)index;
+            const GLfloat* p = xyz + 3*(size_t)index;
+            x[n] = p[0];
+            y[n] = p[1];
+            z[n] = p[2];
+            pixel[n++] = row*width + col;
+            if (n == (size_t)project_block)
+                flush();
+        }
+    }
+    if (n > 0)
+        flush();
+}
+
+cv::Mat cpu_renderer::render(const GLfloat* xyz, size_t count, const glm::mat4& mvp, job_stats* stats)
+{
+    stage_timer timer;
+    if (mode == CPU_RASTER_ATOMIC)
+    {
+        parallel(num_threads, [&](int t)
+        {
+            splat_slice(xyz, count*t/num_threads, count*(t+1)/num_threads, mvp);
+        });
+        cv::Mat img(height, width, float_output ? CV_32FC1 : CV_16UC1);
+        cv::Mat ids(height, width, CV_32SC1);
+        parallel(num_threads, [&](int t)
+        {
+            resolve_rows(xyz, mvp, height*t/num_threads, height*(t+1)/num_threads, img, ids);
+        });
+        timer.lap(stats, STAGE_DRAW);
+        timer.lap(stats, STAGE_READBACK);
+        last = img;
+        last_ids = ids;
+        return img;
+    }
+
+    parallel(num_threads, [&](int t)
+    {
+        bin(xyz, count*t/num_threads, count*(t+1)/num_threads, mvp, bins[t]);
+    });
+
+    // a fresh buffer per job: the encoder owns it until the file is written
+    cv::Mat img(height, width, float_output ? CV_32FC1 : CV_16UC1);
+    std::atomic<int> next_tile(0);
+    parallel(num_threads, [&](int)
+    {
+        for (int tile = next_tile++; tile < tiles_x*tiles_y; tile = next_tile++)
+            raster_tile(tile, img);
+    });
+    timer.lap(stats, STAGE_DRAW);
+    timer.lap(stats, STAGE_READBACK);
+    last = img;
+    return img;
+}
+
+int cpu_renderer::add_level(int width, int height)
+{
+    levels.push_back(cv::Size(width, height));
+    return (int)levels.size()-1;
+}
+
+template <typename T>
+static void min_pool(const cv::Mat& src, cv::Mat& dst)
+{
+    // the footprint of depth_pool.frag, in the same float arithmetic
+    float rx = (float)src.cols/dst.cols, ry = (float)src.rows/dst.rows;
+    for (int y = 0; y < dst.rows; y++)
+    {
+        int y0 = (int)std::floor(y*ry), y1 = std::min((int)std::ceil((y+1)*ry), src.rows);
+        for (int x = 0; x < dst.cols; x++)
+        {
+            int x0 = (int)std::floor(x*rx), x1 = std::min((int)std::ceil((x+1)*rx), src.cols);
+            T d = 0;
+            for (int yy = y0; yy < y1; yy++)
+            {
+                const T* row = src.ptr<T>(yy);
+                for (int xx = x0; xx < x1; xx++)
+                    if (row[xx] != 0 && (d == 0 || row[xx] < d))
+                        d = row[xx];
+            }
+            dst.ptr<T>(y)[x] = d;
+        }
+    }
+}
+
+cv::Mat cpu_renderer::read_level(int i, job_stats* stats)
+{
+    stage_timer timer;
+    cv::Mat img(levels[i].height, levels[i].width, last.type());
+    if (float_output)
+        min_pool<float>(last, img);
+    else
+        min_pool<unsigned short>(last, img);
+    timer.lap(stats, STAGE_DRAW);
+    return img;
+}
@@ -0,0 +1,73 @@
+#ifndef __CPU_RENDERER_H__
+#define __CPU_RENDERER_H__
+
+#include "depth_index.h"
+#include "renderer.h"
+
+#include <string>
+#include <vector>
+
+// depth_rasterizer on the cpu for nodes without any GL, selected with --renderer cpu.
+// Points are projected and binned into 64x64 screen tiles by num_threads threads
+// (each its own contiguous slice of the cloud), then the tiles are rasterized in
+// parallel, each with its own depth buffer. Within a tile splats are drawn in cloud
+// order like the gpu does, so ties resolve the same way.
+//
+// CPU_RASTER_ATOMIC skips the binning: every thread splats its slice straight into
+// one shared depth_index_buffer, which is then resolved into the depth image and a
+// per-pixel point id image. Same output, and the point ids come for free.
+enum cpu_raster
+{
+    CPU_RASTER_TILES,
+    CPU_RASTER_ATOMIC
+};
+
+bool parse_cpu_raster(const std::string& name, cpu_raster& mode);
+
+class cpu_renderer : public depth_rasterizer
+{
+public:
+    explicit cpu_renderer(int num_threads, cpu_raster mode = CPU_RASTER_TILES);
+
+    bool init(int width, int height, bool float_output);
+    void destroy();
+
+    // projection, binning and rasterization all count as draw
+    using depth_rasterizer::render;
+    cv::Mat render(const GLfloat* xyz, size_t count, const glm::mat4& mvp, job_stats* stats = NULL);
+
+    int add_level(int width, int height);
+    cv::Mat read_level(int i, job_stats* stats = NULL);
+
+    // only CPU_RASTER_ATOMIC has them, empty otherwise
+    cv::Mat read_ids() { return last_ids; }
+
+private:
+    // a splat's pixel rectangle [x0,x1) x [y0,y1), clipped to its tile by the rasterizer
+    struct splat
+    {
+        int x0, y0, x1, y1;
+        float depth;    // ndc z, for the depth test
+        float z;        // clip z, the value written
+    };
+
+    bool make_splat(float sx, float sy, float cz, float cw, splat& s) const;
+    void bin(const GLfloat* xyz, size_t begin, size_t end, const glm::mat4& mvp, std::vector<std::vector<splat> >& bins);
+    void raster_tile(int tile, cv::Mat& img);
+    void splat_slice(const GLfloat* xyz, size_t begin, size_t end, const glm::mat4& mvp);
+    void resolve_rows(const GLfloat* xyz, const glm::mat4& mvp, int y0, int y1, cv::Mat& img, cv::Mat& ids);
+
+    int num_threads;
+    cpu_raster mode;
+    int width, height;
+    bool float_output;
+    int tiles_x, tiles_y;
+    // bins[thread][tile], kept across renders so their memory is reused
+    std::vector<std::vector<std::vector<splat> > > bins;
+    depth_index_buffer nearest;
+    std::vector<cv::Size> levels;
+    cv::Mat last;
+    cv::Mat last_ids;
+};
+
+#endif
@@ -0,0 +1,18 @@
+#include "depth_index.h"
+
+const uint32_t depth_index_buffer::no_point;
+const uint64_t depth_index_buffer::empty;
+
+depth_index_buffer::depth_index_buffer()
+    : w(0), h(0)
+{
+}
+
+void depth_index_buffer::resize(int width, int height)
+{
+    w = width;
+    h = height;
+    words.reset(new std::atomic<uint64_t>[(size_t)w*h]);
+    for (size_t i = 0; i < (size_t)w*h; i++)
+        words[i].store(empty, std::memory_order_relaxed);
+}
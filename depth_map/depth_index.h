@@ -0,0 +1,63 @@
+#ifndef __DEPTH_INDEX_H__
+#define __DEPTH_INDEX_H__
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+// Shared depth buffer for splatting from many threads without locks. Every pixel
+// is one 64-bit word, the depth's bits (mapped so unsigned order is float order)
+// above the point index; splats keep the word's minimum with a compare-exchange
+// loop. The nearest point wins and of equally near ones the lowest index, so the
+// result does not depend on the thread schedule and matches GL_LESS in cloud order.
+class depth_index_buffer
+{
+public:
+    static const uint32_t no_point = 0xffffffffu;
+
+    depth_index_buffer();
+
+    // all pixels empty
+    void resize(int width, int height);
+    int width() const { return w; }
+    int height() const { return h; }
+
+    // [x0,x1) x [y0,y1), already clipped to the buffer
+    void splat(int x0, int y0, int x1, int y1, float depth, uint32_t index)
+    {
+        uint64_t word = (uint64_t)ordered(depth) << 32 | index;
+        for (int y = y0; y < y1; y++)
+        {
+            std::atomic<uint64_t>* row = words.get() + (size_t)y*w;
+            for (int x = x0; x < x1; x++)
+            {
+                uint64_t old = row[x].load(std::memory_order_relaxed);
+                while (word < old && !row[x].compare_exchange_weak(old, word, std::memory_order_relaxed))
+                    ;
+            }
+        }
+    }
+
+    // point index of pixel (x, y), no_point if nothing covers it; resets the pixel
+    // so the buffer is empty again once every pixel has been taken
+    uint32_t take(int x, int y)
+    {
+        return (uint32_t)words[(size_t)y*w + x].exchange(empty, std::memory_order_relaxed);
+    }
+
+private:
+    static const uint64_t empty = ~(uint64_t)0;
+
+    // flips negative floats entirely and sets the sign bit of positive ones
+    static uint32_t ordered(float depth)
+    {
+        union { float f; uint32_t u; } bits;
+        bits.f = depth;
+        return bits.u & 0x80000000u ? ~bits.u : bits.u | 0x80000000u;
+    }
+
+    int w, h;
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "depth_lib.h"
+#include "cloud.h"
+#include "cpu_renderer.h"
+#include "renderer.h"
+
+// the gl platform is process wide, engines share it and the last one out terminates it
+static std::mutex platform_mutex;
+static int platform_users = 0;
+static gl_backend platform_backend;
+
+depth_options::depth_options()
+    : scale(0.2f), float_output(false), filter(false), backend(default_gl_backend()), splat(SPLAT_GEOMETRY), depth_only(false), cpu_threads(0)
+{
+}
+
+depth_engine::depth_engine()
+    : ctx(NULL), renderer(NULL)
+{
+}
+
+depth_engine::~depth_engine()
+{
+    destroy();
+}
+
+bool depth_engine::init(const depth_options& options)
+{
+    destroy();
+    std::lock_guard<std::mutex> lock(mtx);
+    opts = options;
+    if (opts.cpu_threads > 0)
+    {
+        renderer = new cpu_renderer(opts.cpu_threads);
+        return renderer->init(opts.width(), opts.height(), opts.float_output);
+    }
+    {
+        std::lock_guard<std::mutex> platform_lock(platform_mutex);
+        if (platform_users > 0 && platform_backend != opts.backend)
+        {
+            fprintf(stderr, "the %s backend is already in use, cannot mix in %s\n",
+                gl_backend_name(platform_backend), gl_backend_name(opts.backend));
+            return false;
+        }
+        if (platform_users == 0 && !init_gl_platform(opts.backend))
+            return false;
+        platform_backend = opts.backend;
+        platform_users++;
+    }
+
+    ctx = create_gl_context();
+    if (!ctx || !ctx->make_current() || !init_glew())
+    {
+        fprintf(stderr, "Failed to create a GL context for the depth engine\n");
+        delete ctx;
+        ctx = NULL;
+    }
+    else
+    {
+        renderer = new depth_renderer(opts.splat, opts.depth_only);
+        if (!renderer->init(opts.width(), opts.height(), opts.float_output))
+        {
+            renderer->destroy();
+            delete renderer;
+            renderer = NULL;
+            ctx->release();
+            delete ctx;
+            ctx = NULL;
+        }
+        else
+            ctx->release();
+    }
+    if (!ctx)
+    {
+        std::lock_guard<std::mutex> platform_lock(platform_mutex);
+        if (--platform_users == 0)
+            terminate_gl_platform();
+        return false;
+    }
+    return true;
+}
+
+void depth_engine::destroy()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!ctx)
+    {
+        // cpu renderer, or nothing
+        if (renderer)
+            renderer->destroy();
+        delete renderer;
+        renderer = NULL;
+        return;
+    }
+    ctx->make_current();
+    renderer->destroy();
+    delete renderer;
+    renderer = NULL;
+    ctx->release();
+    delete ctx;
+    ctx = NULL;
+
+    std::lock_guard<std::mutex> platform_lock(platform_mutex);
+    if (--platform_users == 0)
+        terminate_gl_platform();
+}
+
+cv::Mat depth_engine::render(const float* xyz, size_t count, const depth_camera& camera)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!renderer || (ctx && !ctx->make_current()))
+        return cv::Mat();
+
+    if (opts.filter)
+    {
+        filter_points(xyz, count, filtered);
+        xyz = filtered.empty() ? NULL : &filtered[0];
+        count = filtered.size()/3;
+    }
+    glm::mat4 mvp = getMVP(camera, opts.width(), opts.height(), opts.scale);
+    cv::Mat img = renderer->render(xyz, count, mvp);
+    if (ctx)
+        ctx->release();
+    return img;
+}
+
+// render_depth's engine, file scope like the platform state: VS2012 does not construct
+// function statics thread safely, two first calls could race on the lock itself.
+// Destroyed before platform_mutex, defined above
+static depth_engine shared_engine;
+static std::mutex engine_mutex;
+
+cv::Mat render_depth(const float* xyz, size_t count, const depth_camera& camera, const depth_options& options)
+{
+    depth_engine& engine = shared_engine;
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    const depth_options& o = engine.options();
+    if (!engine.is_open() || o.scale != options.scale || o.float_output != options.float_output ||
+        o.filter != options.filter || o.backend != options.backend || o.splat != options.splat ||
+        o.depth_only != options.depth_only || o.cpu_threads != options.cpu_threads)
+    {
+        if (!engine.init(options))
+            return cv::Mat();
+    }
+    return engine.render(xyz, count, camera);
+}
@@ -0,0 +1,72 @@
+#ifndef __DEPTH_LIB_H__
+#define __DEPTH_LIB_H__
+
+// In-process depth map rendering, the library behind depth_map. Points and images stay
+// in memory: no ply is parsed and no png is written unless the caller does it with
+// cloud.h and output.h.
+//
+//     depth_camera cam = ...;          // or camera_store::find
+//     cv::Mat depth = render_depth(xyz, n, cam);
+//
+// depth_engine owns an offscreen GL context and the renderer, or only a cpu_renderer. Its calls may come from
+// any thread, they are serialized; use one engine per thread to render in parallel.
+// With the glfw backend the engine must be created and destroyed on the main thread.
+// The shaders are loaded from ./shaders like depth_map does.
+
+#define OPENCV_REQUIRED
+#include "../common/shader.h"
+
+#include "camera.h"
+#include "context.h"
+#include "renderer.h"
+
+#include <mutex>
+
+struct depth_options
+{
+    // output size and intrinsics relative to the 1920x1080 calibration
+    float scale;
+    // CV_32FC1 in units of 1000 instead of the CV_16UC1 png values (f32*10000)
+    bool float_output;
+    // drop points outside the region of interest (cloud.h) before rendering
+    bool filter;
+    gl_backend backend;
+    splat_path splat;
+    // no colour attachment while drawing, see depth_renderer
+    bool depth_only;
+    // cpu_threads > 0 renders on that many cpu threads instead, without any GL
+    int cpu_threads;
+
+    depth_options();
+    int width() const { return (int)(1920*scale); }
+    int height() const { return (int)(1080*scale); }
+};
+
+class depth_engine
+{
+public:
+    depth_engine();
+    ~depth_engine();
+
+    bool init(const depth_options& options = depth_options());
+    void destroy();
+    bool is_open() const { return renderer != NULL; }
+    const depth_options& options() const { return opts; }
+
+    // count xyz triples; an empty Mat if the engine is not initialized.
+    // rows are top-down, 0 where no point was hit
+    cv::Mat render(const float* xyz, size_t count, const depth_camera& camera);
+
+private:
+    depth_options opts;
+    gl_context* ctx;
+    class depth_rasterizer* renderer;
+    std::vector<GLfloat> filtered;
+    std::mutex mtx;
+};
+
+// one shot convenience on a process wide engine, re-initialized when the options change
+cv::Mat render_depth(const float* xyz, size_t count, const depth_camera& camera,
+    const depth_options& options = depth_options());
+
+#endif
@@ -0,0 +1,89 @@
+#include "encoder.h"
+
+#include <cstdio>
+
+encoder_pool::encoder_pool(int num_threads, int max_queued, output_writer* writer)
+    : max_queued(max_queued > 0 ? max_queued : 1), writer(writer), stopping(false), failed(0)
+{
+    if (num_threads < 1)
+        num_threads = 1;
+    for (int i = 0; i < num_threads; i++)
+        threads.push_back(std::thread(&encoder_pool::worker, this));
+}
+
+encoder_pool::~encoder_pool()
+{
+    finish();
+}
+
+void encoder_pool::push(cv::Mat img, const std::string& filename, const job_stats& stats)
+{
+    push(std::vector<cv::Mat>(1, img), std::vector<std::string>(1, filename), filename, stats);
+}
+
+void encoder_pool::push(const std::vector<cv::Mat>& imgs, const std::vector<std::string>& filenames,
+    const std::string& key, const job_stats& stats, const std::vector<output_writer*>& writers)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    not_full.wait(lock, [this]{ return queue.size() < max_queued; });
+    encode_job job;
+    job.imgs = imgs;
+    job.filenames = filenames;
+    job.writers = writers;
+    job.key = key;
+    job.stats = stats;
+    queue.push_back(job);
+    not_empty.notify_one();
+}
+
+void encoder_pool::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stopping)
+            return;
+        stopping = true;
+    }
+    not_empty.notify_all();
+    for (auto& t:threads)
+        t.join();
+    threads.clear();
+    if (!writer->close())
+        failed++;
+}
+
+void encoder_pool::worker()
+{
+    for (;;)
+    {
+        encode_job job;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            not_empty.wait(lock, [this]{ return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            job = queue.front();
+            queue.pop_front();
+            not_full.notify_one();
+        }
+        stage_timer timer;
+        bool ok = true;
+        job.stats.bytes_written = 0;
+        for (size_t i = 0; i < job.imgs.size(); i++)
+        {
+            size_t bytes = 0;
+            output_writer* w = i < job.writers.size() && job.writers[i] ? job.writers[i] : writer;
+            if (!w->write(job.imgs[i], job.filenames[i], bytes))
+            {
+                fprintf(stderr, "Failed to write file %s\n", job.filenames[i].c_str());
+                std::lock_guard<std::mutex> lock(mtx);
+                failed++;
+                ok = false;
+            }
+            job.stats.bytes_written += bytes;
+        }
+        timer.lap(&job.stats, STAGE_ENCODE);
+        if (written)
+            written(job.key, ok, job.stats);
+    }
+}
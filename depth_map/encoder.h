@@ -0,0 +1,63 @@
+#ifndef __ENCODER_H__
+#define __ENCODER_H__
+
+#include "output.h"
+#include "stats.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Writes images on a pool of worker threads so that png compression does not
+// stall the render loop. push() takes ownership of the image and blocks while
+// max_queued images are already waiting (backpressure). The writer is not owned.
+class encoder_pool
+{
+public:
+    encoder_pool(int num_threads, int max_queued, output_writer* writer);
+    ~encoder_pool();
+
+    // stats travel with the image and get the encode time and bytes written added
+    void push(cv::Mat img, const std::string& filename, const job_stats& stats);
+    // several outputs of one job (e.g. its scales), written back to back by one encoder;
+    // the callback runs once for the job with key. writers, if given, has one per image,
+    // NULL for the pool's (e.g. npy for point ids next to png depth)
+    void push(const std::vector<cv::Mat>& imgs, const std::vector<std::string>& filenames,
+        const std::string& key, const job_stats& stats,
+        const std::vector<output_writer*>& writers = std::vector<output_writer*>());
+    // waits until every queued image is written, joins the workers and closes the writer
+    void finish();
+
+    int failures() const { return failed; }
+
+    // called on the encoder thread after each job with the key, whether it succeeded and its stats
+    void set_callback(std::function<void(const std::string&, bool, const job_stats&)> cb) { written = cb; }
+
+private:
+    struct encode_job
+    {
+        std::vector<cv::Mat> imgs;
+        std::vector<std::string> filenames;
+        std::vector<output_writer*> writers;
+        std::string key;
+        job_stats stats;
+    };
+
+    void worker();
+
+    std::vector<std::thread> threads;
+    std::deque<encode_job> queue;
+    std::mutex mtx;
+    std::condition_variable not_empty, not_full;
+    size_t max_queued;
+    output_writer* writer;
+    std::function<void(const std::string&, bool, const job_stats&)> written;
+    bool stopping;
+    int failed;
+};
+
+#endif
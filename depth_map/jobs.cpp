@@ -0,0 +1,94 @@
+#include "jobs.h"
+
+#include <cstdio>
+#include <sstream>
+
+job_source::job_source()
+    : has_single(false), line_number(0), job_number(0), shard_index(0), shard_count(1)
+{
+}
+
+void job_source::set_single(const cmd& c)
+{
+    single = c;
+    has_single = true;
+}
+
+bool job_source::open_list(const char* list_fn)
+{
+    list.open(list_fn);
+    list_name = list_fn;
+    return list.is_open();
+}
+
+void job_source::set_shard(int index, int count)
+{
+    shard_index = index;
+    shard_count = count;
+}
+
+bool job_source::next(cmd& c)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (has_single)
+    {
+        has_single = false;
+        c = single;
+        return shard_index == 0;
+    }
+
+    std::string line;
+    while (std::getline(list, line))
+    {
+        line_number++;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+        // the shard is decided before parsing, other shards' lines are only counted
+        if (job_number++ % shard_count != shard_index)
+            continue;
+
+        if (!parse_job(line, c))
+        {
+            fprintf(stderr, "%s:%ld: expected \"ply png calib panel camera\", skipped\n",
+                list_name.c_str(), line_number);
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+long job_source::count()
+{
+    if (has_single)
+        return shard_index == 0 ? 1 : 0;
+
+    std::ifstream in(list_name.c_str());
+    std::string line;
+    long n = 0, jobs = 0;
+    while (std::getline(in, line))
+    {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+        if (n++ % shard_count == shard_index)
+            jobs++;
+    }
+    return jobs;
+}
+
+bool parse_job(const std::string& line, cmd& c)
+{
+    std::istringstream fields(line);
+    return (bool)(fields >> c.ply_name >> c.png_name >> c.calib_file >> c.panel_number >> c.camera_number);
+}
+
+bool parse_shard(const char* s, int& index, int& count)
+{
+    char slash;
+    std::istringstream in(s);
+    if (!(in >> index >> slash >> count) || slash != '/' || count < 1 || index < 0 || index >= count)
+        return false;
+    return true;
+}
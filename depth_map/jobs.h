@@ -0,0 +1,53 @@
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include <string>
+#include <fstream>
+#include <mutex>
+
+struct cmd
+{
+    std::string ply_name;
+    std::string png_name;
+    std::string calib_file;
+    int panel_number;
+    int camera_number;
+};
+
+// Hands out jobs one at a time, either a single command given on the command line
+// or lines "ply png calib panel camera" streamed from a list file, so a manifest
+// is never held in memory. With shard_count > 1 only every shard_count-th job
+// (starting at shard_index) is returned, which lets several processes split one
+// list deterministically. Empty lines and lines starting with '#' are not jobs.
+// next() may be called from several threads.
+class job_source
+{
+public:
+    job_source();
+
+    void set_single(const cmd& c);
+    bool open_list(const char* list_fn);
+    void set_shard(int index, int count);
+
+    bool next(cmd& c);
+    // number of jobs of this shard, by a separate pass over the list
+    long count();
+
+private:
+    std::mutex mtx;
+    bool has_single;
+    cmd single;
+    std::ifstream list;
+    std::string list_name;
+    long line_number;
+    long job_number;
+    int shard_index, shard_count;
+};
+
+// parses a job line "ply png calib panel camera"
+bool parse_job(const std::string& line, cmd& c);
+
+// parses "i/N" as used by --shard
+bool parse_shard(const char* s, int& index, int& count);
+
+#endif
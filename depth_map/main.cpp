@@ -4,16 +4,25 @@
 // Include GLEW. Always include it before gl.h and glfw.h, since it's a bit magic.
 #include <GL/glew.h>
 
-// Include GLFW
-#include <GLFW/glfw3.h>
-
 #include <glm/gtc/type_ptr.hpp>
 
-#include <json/json.h>
-
-#include "../3rdparty/rply-1.1.4/rply.h"
+#include "camera.h"
+#include "cloud.h"
+#include "cloud_batch.h"
+#include "cloud_cache.h"
+#include "context.h"
+#include "cpu_renderer.h"
+#include "encoder.h"
+#include "jobs.h"
+#include "output.h"
+#include "progress.h"
+#include "renderer.h"
+#include "server.h"
+#include "visibility.h"
 
 #include <thread>
+#include <atomic>
+#include <mutex>
 #include <fstream>
 #include <sstream>
 #include <iterator>
@@ -25,7 +34,8 @@
 std::random_device rd;
 std::mt19937 rng(rd());
 
-const float scale = 0.2f;
+// output size and intrinsics relative to the 1920x1080 calibration, unless --scales is given
+const float default_scale = 0.2f;
 
 float gen_random_float(float min=0.0f, float max=1.0f)
 {
@@ -33,392 +43,679 @@ float gen_random_float(float min=0.0f, float max=1.0f)
     return dist(rng);
 }
 
-// Is called whenever a key is pressed/released via GLFW
-void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode)
+// "0.2,0.1,0.05", every value > 0
+bool parse_scales(const char* s, std::vector<float>& scales)
 {
-    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, GL_TRUE);
-}
-
-std::vector<GLfloat> g_vertex_buffer_data;
-float ply_buf[3];
-int ply_buf_c=0;
-
-static int vertex_cb(p_ply_argument argument) {
-    long eol;
-    ply_get_argument_user_data(argument, NULL, &eol);
-    //printf("%g", ply_get_argument_value(argument));
-    ply_buf[ply_buf_c] = (float)ply_get_argument_value(argument);
-    ply_buf_c++;
-    if (ply_buf_c==3) {
-        ply_buf_c = 0;
-        if (ply_buf[1]<-5.0 && (ply_buf[0]*ply_buf[0]+ply_buf[2]*ply_buf[2])<45000)
-        {
-            g_vertex_buffer_data.push_back(ply_buf[0]);
-            g_vertex_buffer_data.push_back(ply_buf[1]);
-            g_vertex_buffer_data.push_back(ply_buf[2]);
-        }
+    std::vector<float> parsed;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        float v = (float)std::atof(item.c_str());
+        if (v <= 0.0f)
+            return false;
+        parsed.push_back(v);
     }
-    return 1;
+    if (parsed.empty())
+        return false;
+    scales = parsed;
+    return true;
 }
 
-int read_ply(const char* ply_filename)
+// out.png with _id -> out_id.png
+std::string suffixed_name(const std::string& name, const std::string& suffix)
 {
-    g_vertex_buffer_data.clear();
-    long nvertices, ntriangles;
-    p_ply ply = ply_open(ply_filename, NULL, 0, NULL);
-    if (!ply) return -1;
-    if (!ply_read_header(ply)) return -1;
-    nvertices = ply_set_read_cb(ply, "vertex", "x", vertex_cb, NULL, 0);
-    ply_set_read_cb(ply, "vertex", "y", vertex_cb, NULL, 0);
-    ply_set_read_cb(ply, "vertex", "z", vertex_cb, NULL, 1);
-    ntriangles = ply_set_read_cb(ply, "face", "vertex_indices", NULL, NULL, 0);
-    //printf("%ld\n%ld\n", nvertices, ntriangles);
-    if (!ply_read(ply)) return -1;
-    ply_close(ply);
-    return 0;
+    size_t dot = name.find_last_of('.');
+    size_t slash = name.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return name + suffix;
+    return name.substr(0, dot) + suffix + name.substr(dot);
 }
 
-static std::string cache_calib_name="";
-static std::map<int, Json::Value> camera_dict;
-static int cache_camera_num = -1;
-static glm::mat4 cache_mvp;
+// out.png at scale 0.1 -> out_x0.1.png
+std::string scaled_name(const std::string& name, float scale)
+{
+    char suffix[32];
+    sprintf(suffix, "_x%g", scale);
+    return suffixed_name(name, suffix);
+}
 
-glm::mat4 getMVP(std::string calib_filename, int panelIdx, int cameraIdx, int width, int height)
+// --visibility: every camera of the calibration renders the cloud once, f32 depth and point ids
+static int run_visibility(const std::string& out_path, const char* ply_name, const char* calib_name, bool cpu,
+    int cpu_threads, gl_backend backend, splat_path splat, float scale, float tolerance)
 {
-    if (cache_camera_num == panelIdx*100+cameraIdx)
+    std::vector<GLfloat> raw, points;
+    std::vector<int> vertices;
+    if (read_ply(ply_name, raw))
     {
-        return cache_mvp;
+        fprintf(stderr, "Failed to read file %s\n", ply_name);
+        return -1;
     }
-
-    GLfloat near = 0.1f;
-    GLfloat far = 1000.0f;
-    glm::mat4 Projection, View;
+    filter_points(raw, points, vertices);
+    camera_store cameras;
+    std::vector<int> numbers;
+    if (cameras.load(calib_name))
+        numbers = cameras.numbers();
+    if (numbers.empty())
     {
-        if (calib_filename != cache_calib_name)
-        {
-            printf("loading %s\n", calib_filename);
-            Json::Value root;
-            Json::Reader reader;
-            std::ifstream file(calib_filename, std::ifstream::binary);
-            if(!reader.parse(file, root, true)){
-                std::cout  << "Failed to parse configuration\n"
-                    << reader.getFormattedErrorMessages();
-            }
-            const Json::Value cameras = root["cameras"];
-            cache_calib_name = calib_filename;
-            for (int i = 0; i < cameras.size(); i++)
-            {
-                const char* cam_name = cameras[i]["name"].asCString();
-                int pidx, cidx;
-                sscanf(cam_name, "%02d_%02d", &pidx, &cidx);
-                camera_dict[pidx*100+cidx] = cameras[i];
-                //if (cameras[i]["name"].asString() == camera_name)
-                //{
-                //    camera = cameras[i];
-                //    break;
-                //}
-            }
-        }
-        Json::Value camera = camera_dict[panelIdx*100+cameraIdx];
-        
-        float fx = camera["K"][0][0].asFloat()*scale;
-        float fy = camera["K"][1][1].asFloat()*scale;
-        float cx = camera["K"][0][2].asFloat()*scale;
-        float cy = camera["K"][1][2].asFloat()*scale;
-        float RT_float[16] = {0.0f};
-        for (int i = 0; i < 3; i++)
-        {
-            for (int j = 0; j < 3; j++)
-            {
-                RT_float[i*4+j] = camera["R"][i][j].asFloat();
-            }
-            RT_float[i*4+3] = camera["t"][i][0].asFloat();
-        }
-        RT_float[15] = 1.0f;
-
-
-        //float fx = 1396.52f;
-        //float fy = 1393.52f;
-        //float cx = 933.738f;
-        //float cy = 560.443f;
-        //
-        //float RT_float[16] = {
-        //    -0.9225427896f,-0.01123881405f, -0.3857311115f, -10.70728522f,
-        //    -0.02283482308f, 0.999414139f, 0.02549411087f, 143.7188498f,
-        //    0.3852186031f, 0.03232750985f, -0.9222589441f, 277.0709018f,
-        //    0.0f, 0.0f, 0.0f, 1.0f
-        //};
-
-        float w = (float)width;
-        float h = (float)height;
-
-        float l = 0.0, r = 1.0*w, b = 1.0*h, t = 0.0;
-        float tx = -(r+l)/(r-l), ty = -(t+b)/(t-b), tz = -(far+near)/(far-near);
-        float ortho_float[16] = {2.0/(r-l), 0.0, 0.0, tx,
-            0.0, 2.0/(t-b), 0.0, ty,
-            0.0, 0.0, -2.0/(far-near), tz,
-            0.0, 0.0, 0.0, 1.0};
-        float Intrinsic_float[16] = {fx, 0, cx, 0.0,
-            0.0, fy, cy, 0.0,
-            0.0, 0.0, -(near+far), +near*far,
-            0.0, 0.0, 1.0 , 0.0};
-        glm::mat4 ortho = glm::make_mat4(ortho_float);
-        glm::mat4 Intrinsic = glm::make_mat4(Intrinsic_float);
-
-        ortho = glm::transpose(ortho);
-        Intrinsic = glm::transpose(Intrinsic);
-
-        Projection = ortho*Intrinsic;
-
-        glm::mat4 RT = glm::transpose(glm::make_mat4(RT_float));
-        View = RT;
+        fprintf(stderr, "No cameras in %s\n", calib_name);
+        return -1;
     }
+    // camera indices are uint16 in the output (visibility.h)
+    if (numbers.size() > 65535)
+    {
+        fprintf(stderr, "%s has %lu cameras, --visibility takes at most 65535\n", calib_name, (unsigned long)numbers.size());
+        return -1;
+    }
+    int width = (int)(1920*scale), height = (int)(1080*scale);
 
-    // Model matrix : an identity matrix (model will be at the origin)
-    glm::mat4 Model = glm::mat4(1.0f);
-    // Our ModelViewProjection : multiplication of our 3 matrices
-    glm::mat4 mvp = Projection * View * Model; // Remember, matrix multiplication is the other way around
-
-    cache_camera_num = panelIdx*100+cameraIdx;
-    cache_mvp = mvp;
-    return mvp;
+    gl_context* ctx = NULL;
+    if (!cpu && (!init_gl_platform(backend) || !(ctx = create_gl_context()) || !ctx->make_current() || !init_glew()))
+    {
+        fprintf(stderr, "Failed to create a GL context\n");
+        delete ctx;
+        return -1;
+    }
+    depth_renderer gl_renderer(splat);
+    cpu_renderer soft_renderer(cpu_threads, CPU_RASTER_ATOMIC);
+    depth_rasterizer& renderer = ctx ? (depth_rasterizer&)gl_renderer : soft_renderer;
+    bool ok = renderer.init(width, height, true) && (!ctx || gl_renderer.set_channels(false, true));
+    // uploaded once for all cameras
+    cloud_cache clouds(ctx ? sizeof(GLfloat)*points.size() : 0);
+    const cloud_cache::cloud* cloud = ok ? clouds.insert(ply_name, points, raw.size()/3) : NULL;
+    visibility_map vis(raw.size()/3, (int)numbers.size());
+    for (size_t c = 0; ok && c < numbers.size(); c++)
+    {
+        const depth_camera* camera = cameras.find(numbers[c]/100, numbers[c]%100);
+        glm::mat4 mvp = getMVP(*camera, width, height, scale);
+        cv::Mat depth = cloud ? gl_renderer.render(cloud->buffer, cloud->count, mvp) : renderer.render(points, mvp);
+        vis.add_camera((int)c, depth, renderer.read_ids(), points, vertices, mvp, tolerance);
+        printf("camera %02d_%02d\n", numbers[c]/100, numbers[c]%100);
+    }
+    clouds.clear();
+    renderer.destroy();
+    if (ctx)
+    {
+        ctx->release();
+        delete ctx;
+        terminate_gl_platform();
+    }
+    if (!ok || !vis.write(out_path, numbers))
+        return -1;
+    printf("%lu points, %lu cameras, written to %s\n", (unsigned long)vis.points(), (unsigned long)numbers.size(), out_path.c_str());
+    return 0;
 }
 
-struct cmd
+void usage()
 {
-    std::string ply_name;
-    std::string png_name;
-    std::string calib_file;
-    int panel_number;
-    int camera_number;
-};
+    std::cout<<"usage: depth_map [options] *.ply *.png calib.json 0 5\n";
+    std::cout<<"usage: depth_map [options] list.txt\n";
+    std::cout<<"usage: depth_map [options] --serve -|unix:PATH\n";
+    std::cout<<"usage: depth_map [options] --visibility out.vis *.ply calib.json\n";
+    std::cout<<"options:\n";
+    std::cout<<"  --serve W        keep running and take list lines from stdin (-) or a unix socket, replying\n";
+    std::cout<<"                   {\"key\", \"status\", \"ms\"} per job on the same stream; the log moves to stderr\n";
+    std::cout<<"  --threads N      render threads, each with its own GL context (default: 1)\n";
+    std::cout<<"  --renderer R     gl (default) or cpu, a tiled software splatter that needs no GL at all\n";
+    std::cout<<"  --splat P        gl splatting: geometry (default, depth.geo), instanced (one quad instance per\n";
+    std::cout<<"                   point, no geometry shader) or compute (image atomics, GL 4.3)\n";
+    std::cout<<"  --target T       gl render target: color (default, R16UI/R32F plus a depth renderbuffer) or depth,\n";
+    std::cout<<"                   depth only into a 32-bit float depth texture, quantized by a resolve pass\n";
+    std::cout<<"  --splat-size S   fixed (default, +-0.8 in clip space) or adaptive: from every point's local spacing\n";
+    std::cout<<"                   and depth, for sparse or voxel-downsampled clouds; geometry path, no gpu cache\n";
+    std::cout<<"  --splat-scale K  adaptive half width in spacings (default: 1)\n";
+    std::cout<<"  --splat-max PX   adaptive half width limit in pixels (default: 16)\n";
+    std::cout<<"  --batch B        .scene jobs (many clouds, see cloud_batch.h; gl, fixed splat sizes): multi (default),\n";
+    std::cout<<"                   one multi draw indirect over all clouds, or loop, an upload and a draw per cloud\n";
+    std::cout<<"  --fill N         push-pull hole filling over N pyramid levels, holes up to ~2^N pixels (default: 0, off)\n";
+    std::cout<<"  --fill-threshold D  depth spread in png units never averaged across when filling (default: 50)\n";
+    std::cout<<"  --cpu-threads N  threads per cpu renderer (default: cores/threads)\n";
+    std::cout<<"  --cpu-raster M   tiles (default) or atomic, all threads splatting into one lock-free depth|index buffer\n";
+    std::cout<<"  --ids S          also write the ply vertex index each pixel shows (-1: none) as int32 out<S>.npy at\n";
+    std::cout<<"                   the largest scale, from the same draw; gl: color target, no compute splats, no gpu\n";
+    std::cout<<"                   cache; cpu: implies --cpu-raster atomic\n";
+    std::cout<<"  --normals S      gl renderer, also write unit normals of the depth image in the cloud's frame as\n";
+    std::cout<<"                   float32 (h, w, 3) out<S>.npy at the largest scale (0: none)\n";
+    std::cout<<"  --visibility F   instead of depth maps, write which cameras of the calibration see each ply vertex to F\n";
+    std::cout<<"                   (csr, see visibility.h), from point id renders at the largest scale; gl or cpu\n";
+    std::cout<<"  --vis-tolerance D  with --visibility, also count points within D png units of the depth at their\n";
+    std::cout<<"                   pixel, not just those that win one (default: 0)\n";
+    std::cout<<"  --context B      GL context backend: egl, osmesa or glfw, as built in (default: "<<gl_backend_name(default_gl_backend())<<")\n";
+    std::cout<<"  --shader-cache D linked gl programs kept across runs in directory D, keyed by source and driver\n";
+    std::cout<<"                   (default: shader_cache, none: off)\n";
+    std::cout<<"  --shard i/N      only render jobs i, i+N, i+2N, ... of the list (0 <= i < N)\n";
+    std::cout<<"  --gpu-cache MB   filtered clouds kept on the gpu across jobs, split evenly between the render threads,\n";
+    std::cout<<"                   each with its own cache (default: 512, 0: off)\n";
+    std::cout<<"  --encoders N     png encoder threads (default: cores-1)\n";
+    std::cout<<"  --queue N        images waiting for an encoder before rendering blocks (default: 2*encoders)\n";
+    std::cout<<"  --png-level N    png compression level 0-9 (default: opencv default)\n";
+    std::cout<<"  --format F       png (default), raw, npy or stack\n";
+    std::cout<<"  --dtype T        u16 (default, png units) or f32 (unquantized, u16 = f32*10000); png needs u16\n";
+    std::cout<<"  --scales S,S,..  output scales of the 1920x1080 calibration (default: 0.2); rendered once at the\n";
+    std::cout<<"                   largest, the others min-pooled on the gpu; with several, outputs are named out_x<S>.png\n";
+    std::cout<<"  --stack F.npy    stack file for --format stack, png names become keys in F.npy.idx\n";
+    std::cout<<"  --resume J       journal of finished outputs; skips jobs it lists whose output is newer than ply and calib\n";
+    std::cout<<"  --stats F        per-job stage times and counters, csv if F ends in .csv else json lines\n";
+    std::cout<<"  --progress S     print throughput and eta every S seconds (default: 10 with --resume, else off)\n";
+}
 
 int main(int argc, char** argv)
 {
-    std::vector<cmd> commands;
-    if (argc == 6)
+    double start_time = precise_time();
+    int num_encoders = (int)std::thread::hardware_concurrency()-1;
+    int encode_queue = -1;
+    int png_level = -1;
+    output_format format = OUTPUT_PNG;
+    bool float_output = false;
+    std::string stack_path;
+    int shard_index = 0, shard_count = 1;
+    int num_threads = 1;
+    std::string journal_path;
+    std::string stats_path;
+    double progress_interval = -1;
+    gl_backend backend = default_gl_backend();
+    std::string shader_cache = "shader_cache";
+    std::vector<float> scales(1, default_scale);
+    double gpu_cache_mb = 512;
+    std::string serve;
+    bool cpu = false;
+    int cpu_threads = 0;
+    splat_path splat = SPLAT_GEOMETRY;
+    bool depth_only = false;
+    bool adaptive = false;
+    batch_submit submit = BATCH_MULTI_DRAW;
+    float splat_scale = 1.0f, splat_max = 16.0f;
+    int fill_levels = 0;
+    float fill_threshold = 50.0f;
+    cpu_raster raster = CPU_RASTER_TILES;
+    std::string ids_suffix, normals_suffix;
+    std::string vis_path;
+    float vis_tolerance = 0.0f;
+
+    std::vector<char*> args;
+    for (int i=1; i<argc; i++)
     {
-        cmd c;
-        c.ply_name = argv[1];
-        c.png_name = argv[2];
-        c.calib_file = argv[3];
-        c.panel_number = std::atoi(argv[4]);
-        c.camera_number = std::atoi(argv[5]);
-        commands.push_back(c);
+        std::string a = argv[i];
+        if (a.compare(0, 2, "--") != 0)
+        {
+            args.push_back(argv[i]);
+            continue;
+        }
+        if (i+1 >= argc)
+        {
+            usage();
+            exit(-1);
+        }
+        if (a == "--threads")
+            num_threads = std::atoi(argv[++i]);
+        else if (a == "--context" && parse_gl_backend(argv[i+1], backend))
+            i++;
+        else if (a == "--renderer" && (std::string(argv[i+1]) == "gl" || std::string(argv[i+1]) == "cpu"))
+            cpu = std::string(argv[++i]) == "cpu";
+        else if (a == "--splat" && parse_splat_path(argv[i+1], splat))
+            i++;
+        else if (a == "--target" && parse_target(argv[i+1], depth_only))
+            i++;
+        else if (a == "--batch" && parse_batch_submit(argv[i+1], submit))
+            i++;
+        else if (a == "--splat-size" && (std::string(argv[i+1]) == "fixed" || std::string(argv[i+1]) == "adaptive"))
+            adaptive = std::string(argv[++i]) == "adaptive";
+        else if (a == "--splat-scale")
+            splat_scale = (float)std::atof(argv[++i]);
+        else if (a == "--splat-max")
+            splat_max = (float)std::atof(argv[++i]);
+        else if (a == "--fill")
+            fill_levels = std::atoi(argv[++i]);
+        else if (a == "--fill-threshold")
+            fill_threshold = (float)std::atof(argv[++i]);
+        else if (a == "--cpu-threads")
+            cpu_threads = std::atoi(argv[++i]);
+        else if (a == "--cpu-raster" && parse_cpu_raster(argv[i+1], raster))
+            i++;
+        else if (a == "--ids")
+            ids_suffix = argv[++i];
+        else if (a == "--normals")
+            normals_suffix = argv[++i];
+        else if (a == "--visibility")
+            vis_path = argv[++i];
+        else if (a == "--vis-tolerance")
+            vis_tolerance = (float)std::atof(argv[++i]);
+        else if (a == "--serve")
+            serve = argv[++i];
+        else if (a == "--shader-cache")
+            shader_cache = argv[++i];
+        else if (a == "--gpu-cache")
+            gpu_cache_mb = std::atof(argv[++i]);
+        else if (a == "--encoders")
+            num_encoders = std::atoi(argv[++i]);
+        else if (a == "--queue")
+            encode_queue = std::atoi(argv[++i]);
+        else if (a == "--png-level")
+            png_level = std::atoi(argv[++i]);
+        else if (a == "--format" && parse_output_format(argv[i+1], format))
+            i++;
+        else if (a == "--dtype" && (std::string(argv[i+1]) == "u16" || std::string(argv[i+1]) == "f32"))
+            float_output = std::string(argv[++i]) == "f32";
+        else if (a == "--scales" && parse_scales(argv[i+1], scales))
+            i++;
+        else if (a == "--stack")
+            stack_path = argv[++i];
+        else if (a == "--shard" && parse_shard(argv[i+1], shard_index, shard_count))
+            i++;
+        else if (a == "--resume")
+            journal_path = argv[++i];
+        else if (a == "--stats")
+            stats_path = argv[++i];
+        else if (a == "--progress")
+            progress_interval = std::atof(argv[++i]);
+        else
+        {
+            usage();
+            exit(-1);
+        }
     }
-    else if (argc == 2)
+    SetShaderCacheDir(shader_cache == "none" ? "" : shader_cache.c_str());
+    if (num_threads < 1)
+        num_threads = 1;
+    if (cpu_threads < 1)
+        cpu_threads = std::max(1, (int)std::thread::hardware_concurrency()/num_threads);
+    if (num_encoders < 1)
+        num_encoders = 1;
+    if (encode_queue < 1)
+        encode_queue = 2*num_encoders;
+    if (format == OUTPUT_PNG && float_output)
     {
-        const char* list_fn = argv[1];
-        FILE* pFile = fopen(list_fn,"r");
-        char plyn[256], pngn[256], calibn[256];
-        cmd c;
-        while (fscanf(pFile, "%s %s %s %d %d\n", plyn, pngn, calibn, &c.panel_number, &c.camera_number) != EOF)
+        fprintf(stderr, "png output needs --dtype u16\n");
+        exit(-1);
+    }
+    if (format == OUTPUT_STACK && !journal_path.empty())
+    {
+        // the stack file is recreated by every run, finished frames would be lost
+        fprintf(stderr, "--resume does not support --format stack\n");
+        exit(-1);
+    }
+    if (format == OUTPUT_STACK && scales.size() > 1)
+    {
+        // every frame of a stack has the same shape
+        fprintf(stderr, "--format stack takes a single scale\n");
+        exit(-1);
+    }
+    if (!ids_suffix.empty())
+    {
+        // the gl point ids are a second colour attachment of the splat draw
+        if (!cpu && (depth_only || splat == SPLAT_COMPUTE))
         {
-            c.ply_name = std::string(plyn);
-            c.png_name = std::string(pngn);
-            c.calib_file = std::string(calibn);
-            commands.push_back(c);
+            fprintf(stderr, "--ids needs --target color and --splat geometry or instanced\n");
+            exit(-1);
         }
-        fclose(pFile);
+        raster = CPU_RASTER_ATOMIC;
     }
-    else
+    if (cpu && !normals_suffix.empty())
     {
-        std::cout<<"usage: depth_map *.ply *.png calib.json 0 5\n";
-        std::cout<<"usage: depth_map list.txt\n";
+        fprintf(stderr, "--normals needs the gl renderer\n");
         exit(-1);
     }
-
-    // Initialise GLFW
-    if (!glfwInit())
+    if (cpu && (adaptive || fill_levels > 0))
     {
-        fprintf(stderr, "Failed to initialize GLFW\n");
+        fprintf(stderr, "--splat-size adaptive and --fill need the gl renderer\n");
         exit(-1);
     }
+    if (progress_interval < 0)
+        progress_interval = journal_path.empty() ? 0 : 10;
+    if (!vis_path.empty())
+    {
+        if (args.size() != 2)
+        {
+            usage();
+            exit(-1);
+        }
+        // png units are tenths of clip z
+        return run_visibility(vis_path, args[0], args[1], cpu, cpu_threads, backend, splat,
+            *std::max_element(scales.begin(), scales.end()), vis_tolerance/10.0f);
+    }
 
-    glfwWindowHint(GLFW_SAMPLES, 4); // 4x antialiasing
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); //We don't want the old OpenGL 
-    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    // jobs are pulled from the list while rendering, never read up front
+    job_source commands;
+    commands.set_shard(shard_index, shard_count);
+    job_server server;
+    bool serving = !serve.empty();
+    if (serving)
+    {
+        if (!args.empty())
+        {
+            usage();
+            exit(-1);
+        }
+        if (!server.open(serve))
+            exit(-1);
+    }
+    else if (args.size() == 5)
+    {
+        cmd c;
+        c.ply_name = args[0];
+        c.png_name = args[1];
+        c.calib_file = args[2];
+        c.panel_number = std::atoi(args[3]);
+        c.camera_number = std::atoi(args[4]);
+        commands.set_single(c);
+    }
+    else if (args.size() == 1)
+    {
+        if (!commands.open_list(args[0]))
+        {
+            fprintf(stderr, "Failed to open list %s\n", args[0]);
+            exit(-1);
+        }
+    }
+    else
+    {
+        usage();
+        exit(-1);
+    }
 
+    // the cloud is rendered once at the largest scale, smaller ones are downsampled from it
+    float scale = *std::max_element(scales.begin(), scales.end());
     int width=(int)(1920*scale);
     int height=(int)(1080*scale);
 
-    // Open a window and create its OpenGL context
-    GLFWwindow* window; // (In the accompanying source code, this variable is global)
-    window = glfwCreateWindow(width, height, "depth", NULL, NULL);
-    if (window == NULL) {
-        fprintf(stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n");
-        glfwTerminate();
+    if (!cpu && !init_gl_platform(backend))
         exit(-1);
-    }
-    glfwMakeContextCurrent(window); // Initialize GLEW
-
-    // Set the required callback functions
-    // glfwSetKeyCallback(window, key_callback);
 
-    glewExperimental = true; // Needed in core profile
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
-        exit(-1);
+    // one context per render thread, created up front since a glfw window
+    // can only be opened on the main thread; none for the cpu renderer
+    std::vector<gl_context*> contexts(cpu ? num_threads : 0, (gl_context*)NULL);
+    for (int i=0; !cpu && i<num_threads; i++)
+    {
+        gl_context* ctx = create_gl_context();
+        if (!ctx)
+        {
+            terminate_gl_platform();
+            exit(-1);
+        }
+        contexts.push_back(ctx);
     }
 
+    // png compression runs on its own threads, the render loop only blocks when they fall behind
+    output_writer* writer = create_output_writer(format, png_level, stack_path, 0);
+    if (!writer)
+        exit(-1);
+    encoder_pool encoders(num_encoders, encode_queue, writer);
+    // point ids and normals go to npy files next to the outputs, through the same encoders
+    output_writer* npy_writer = NULL;
+    bool channels = !ids_suffix.empty() || !normals_suffix.empty();
+    if (channels && !(npy_writer = create_output_writer(OUTPUT_NPY, png_level, "", 0)))
+        exit(-1);
 
-    // Ensure we can capture the escape key being pressed below
-    // glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
-
-    // Enable depth test
-    glEnable(GL_DEPTH_TEST);
-    // Accept fragment if it closer to the camera than the former one
-    glDepthFunc(GL_LESS);
-
-
-    //vao
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-
-    //vbo
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*g_vertex_buffer_data.size(), &(g_vertex_buffer_data[0]), GL_STATIC_DRAW);
-
-    // 1rst attribute buffer : vertices
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glVertexAttribPointer(
-        0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
-        3,                  // size
-        GL_FLOAT,           // type
-        GL_FALSE,           // normalized?
-        0,                  // stride
-        (void*)0            // array buffer offset
-        );
-
-    // Note that this is allowed, the call to glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
-    glBindBuffer(GL_ARRAY_BUFFER, 0); 
-
-    // Unbind VAO (it's always a good thing to unbind any buffer/array to prevent strange bugs)
-    glBindVertexArray(0); 
-
-
-    //////THE OFFLINE RENDERING
-    // create a texture object
-    GLuint offline_tex;
-    glGenTextures(1, &offline_tex);
-    glBindTexture(GL_TEXTURE_2D, offline_tex);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE); // automatic mipmap
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0,
-        GL_RGBA, GL_FLOAT, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    
-    // create a framebuffer object
-    GLuint fbo;
-    glGenFramebuffersEXT(1, &fbo);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
-
-    // create a renderbuffer object to store depth info
-    GLuint rbo;
-    glGenRenderbuffersEXT(1, &rbo);
-    glBindRenderbufferEXT(GL_RENDERBUFFER, rbo);
-    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24,
-        width, height);
-
-
-    // attach the texture to FBO color attachment point
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,        // 1. fbo target: GL_FRAMEBUFFER 
-        GL_COLOR_ATTACHMENT0_EXT,  // 2. attachment point
-        GL_TEXTURE_2D,         // 3. tex target: GL_TEXTURE_2D
-        offline_tex,             // 4. tex ID
-        0);                    // 5. mipmap level: 0(base)
-
-    // attach the renderbuffer to depth attachment point
-    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT,      // 1. fbo target: GL_FRAMEBUFFER
-        GL_DEPTH_ATTACHMENT, // 2. attachment point
-        GL_RENDERBUFFER,     // 3. rbo target: GL_RENDERBUFFER
-        rbo);              // 4. rbo ID
-
-    // check FBO status
-    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if(status != GL_FRAMEBUFFER_COMPLETE_EXT)
+    job_journal journal;
+    bool resume = !journal_path.empty();
+    if (resume)
     {
-        std::cout <<"cannot create fbo ext";
-        exit(-1);
+        if (!journal.open(journal_path))
+            exit(-1);
+        printf("%lu outputs finished by earlier runs\n", (unsigned long)journal.finished_before());
     }
-    glBindRenderbufferEXT(GL_RENDERBUFFER, 0);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-
-    // Define the viewport dimensions
-    glViewport(0, 0, width, height);
-
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
-    
-    GLuint shaderProgram = LoadShaders("./shaders/depth.vert", "./shaders/depth.frag", "./shaders/depth.geo");
-    // Get a handle for our "MVP" uniform
-    // Only during the initialisation
-    GLuint MatrixID = glGetUniformLocation(shaderProgram, "MVP");
-    GLuint patchsizeID = glGetUniformLocation(shaderProgram, "patchsize");
-    
-    for (auto c:commands)
+    // counting costs a pass over the list, only done when progress is printed
+    progress_meter progress(progress_interval > 0 && !serving ? commands.count() : -1, progress_interval);
+    stats_log stats;
+    if (!stats_path.empty() && !stats.open(stats_path))
+        exit(-1);
+#ifdef DEPTH_MAP_NO_STATS
+    if (stats.is_open())
+        fprintf(stderr, "built with DEPTH_MAP_NO_STATS, stage times will be zero\n");
+#endif
+    encoders.set_callback([&](const std::string& key, bool ok, const job_stats& s)
     {
-        printf("reading %s at cam %02d_%02d\n", c.ply_name.c_str(), c.panel_number, c.camera_number);
-        if (read_ply(c.ply_name.c_str()))
+        if (stats.is_open())
+            stats.record(s);
+        if (serving)
+            server.reply(key, ok ? "done" : "failed");
+        if (!ok)
         {
-            fprintf(stderr, "Failed to read file %s\n", c.ply_name.c_str());
-            continue;
+            progress.failed();
+            return;
         }
-
-        glm::mat4 mvp = getMVP(c.calib_file, c.panel_number, c.camera_number, width, height);
-    
-
-        // Create and compile our GLSL program from the shaders
-
-        for (int i=0; i<2; i++)
+        if (resume)
+            journal.record(key);
+        progress.done();
+    });
+
+    // every render thread owns its context, gl objects, ply buffer and camera cache,
+    // they only share the job list and the encoders
+    std::vector<std::thread> workers;
+    std::atomic<int> failed_workers(0);
+    std::atomic<int> ready_workers(0);
+    // per thread caches, their counters are summed at exit
+    std::mutex cache_mutex;
+    cloud_cache cache_totals(0);
+    for (int t=0; t<num_threads; t++)
+    {
+        gl_context* ctx = contexts[t];
+        workers.push_back(std::thread([&, ctx]
         {
-            // Check and call events
-            glfwPollEvents();
-
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-            // Use our shader
-            glUseProgram(shaderProgram);
-            
-            // Send our transformation to the currently bound shader, in the "MVP" uniform
-            // This is done in the main loop since each model will have a different MVP matrix (At least for the M part)
-            glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &mvp[0][0]);
-            glUniform1f(patchsizeID, 0.8f);
-
-
-            glBindVertexArray(vao);
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*g_vertex_buffer_data.size(), &(g_vertex_buffer_data[0]), GL_STATIC_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, 0); 
-            glDrawArrays(GL_POINTS, 0, g_vertex_buffer_data.size()); 
-            glBindVertexArray(0);
-
-            // Swap buffers
-            glfwSwapBuffers(window);
-            glfwPollEvents();
-        }
+            if (ctx && (!ctx->make_current() || !init_glew()))
+            {
+                fprintf(stderr, "Failed to make a GL context current on a render thread\n");
+                failed_workers++;
+                return;
+            }
 
-        cv::Mat screen(height, width, CV_32FC3);
-        std::vector<cv::Mat> rgbChannels(3);
-        cv::Mat save_img_densified, save_img_non_densified;
+            depth_renderer gl_renderer(splat, depth_only);
+            cpu_renderer soft_renderer(cpu_threads, raster);
+            depth_rasterizer& renderer = ctx ? (depth_rasterizer&)gl_renderer : soft_renderer;
+            // level per scale, -1 for the full size render
+            std::vector<int> scale_level;
+            bool ok = renderer.init(width, height, float_output);
+            if (ok && ctx)
+            {
+                gl_renderer.set_adaptive(splat_scale, splat_max);
+                ok = gl_renderer.set_fill(fill_levels, fill_threshold) &&
+                    gl_renderer.set_channels(!normals_suffix.empty(), !ids_suffix.empty());
+            }
+            for (size_t k=0; ok && k<scales.size(); k++)
+            {
+                int w = (int)(1920*scales[k]), h = (int)(1080*scales[k]);
+                scale_level.push_back(w == width && h == height ? -1 : renderer.add_level(w, h));
+                ok = (w == width && h == height) || scale_level.back() >= 0;
+            }
+            if (!ok)
+            {
+                renderer.destroy();
+                if (ctx)
+                    ctx->release();
+                failed_workers++;
+                return;
+            }
+            // launch cost for short runs: option parsing, gl platform, contexts, glew and shaders
+            if (++ready_workers == num_threads)
+            {
+                double ms = 1000.0*(precise_time() - start_time);
+                printf("startup %.1f ms (%s, %d contexts)\n", ms, cpu ? "cpu" : gl_backend_name(backend), cpu ? 0 : num_threads);
+            }
 
-        glReadPixels(0, 0, width, height, GL_BGR_EXT, GL_FLOAT, screen.data);
-        cv::flip(screen, screen, 0);
-        cv::split(screen, rgbChannels);
-        rgbChannels[0].convertTo(save_img_densified, CV_16UC1, 10000.0);
-        cv::imwrite(c.png_name,save_img_densified);
+            // adaptive splats need each cloud's spacings too and point ids its vertex numbers,
+            // those are not cached
+            bool cacheable = !adaptive && ids_suffix.empty();
+            cloud_cache clouds(ctx && gpu_cache_mb > 0 && cacheable ? (size_t)(gpu_cache_mb*1024*1024/num_threads) : 0);
+            std::vector<GLfloat> raw, points, spacing;
+            std::vector<int> vertices;
+            cloud_batch scene;
+            std::string scene_key;
+            long long scene_loaded = 0;
+            std::vector<std::string> out_names;
+            std::vector<cv::Mat> out_imgs;
+            std::vector<output_writer*> out_writers;
+            camera_store cameras;
+            cmd c;
+            while (serving ? server.next(c) : commands.next(c))
+            {
+                out_names.clear();
+                for (size_t k=0; k<scales.size(); k++)
+                    out_names.push_back(scales.size() == 1 ? c.png_name : scaled_name(c.png_name, scales[k]));
+
+                // finished earlier and no input changed since
+                if (resume && journal.contains(c.png_name))
+                {
+                    bool fresh = true;
+                    for (size_t k=0; k<out_names.size(); k++)
+                    {
+                        long long out_time = file_mtime(writer->output_path(out_names[k]));
+                        fresh = fresh && out_time > file_mtime(c.ply_name) && out_time > file_mtime(c.calib_file);
+                    }
+                    if (fresh)
+                    {
+                        if (serving)
+                            server.reply(c.png_name, "skipped");
+                        progress.skipped();
+                        continue;
+                    }
+                }
+
+                printf("reading %s at cam %02d_%02d\n", c.ply_name.c_str(), c.panel_number, c.camera_number);
+                const depth_camera* camera = cameras.load(c.calib_file) ? cameras.find(c.panel_number, c.camera_number) : NULL;
+                if (!camera)
+                {
+                    fprintf(stderr, "No camera %02d_%02d in %s\n", c.panel_number, c.camera_number, c.calib_file.c_str());
+                    if (serving)
+                        server.reply(c.png_name, "failed");
+                    progress.failed();
+                    continue;
+                }
+                job_stats s;
+                job_stats* sp = stats.is_open() ? &s : NULL;
+                s.key = c.png_name;
+                stage_timer timer;
+                glm::mat4 mvp = getMVP(*camera, width, height, scale);
+                cv::Mat img;
+                if (is_scene(c.ply_name))
+                {
+                    // every cloud of the scene in one draw, uploaded again only when the scene changes
+                    if (!ctx || adaptive || !ids_suffix.empty())
+                    {
+                        fprintf(stderr, "%s: scenes need the gl renderer, fixed splat sizes and no --ids\n", c.ply_name.c_str());
+                        if (serving)
+                            server.reply(c.png_name, "failed");
+                        progress.failed();
+                        continue;
+                    }
+                    std::string key = cloud_key(c.ply_name);
+                    if (key != scene_key)
+                    {
+                        scene.clear();
+                        scene_key.clear();
+                        bool read = read_scene(c.ply_name, scene, scene_loaded) == 0;
+                        timer.lap(sp, STAGE_PARSE);
+                        if (!read || !scene.upload())
+                        {
+                            fprintf(stderr, "Failed to load scene %s\n", c.ply_name.c_str());
+                            scene.clear();
+                            if (serving)
+                                server.reply(c.png_name, "failed");
+                            progress.failed();
+                            continue;
+                        }
+                        timer.lap(sp, STAGE_UPLOAD);
+                        scene_key = key;
+                    }
+                    s.points_loaded = scene_loaded;
+                    s.points_kept = scene.points();
+                    img = gl_renderer.render(scene, mvp, submit, sp);
+                }
+                else
+                {
+                    std::string key = cloud_key(c.ply_name);
+                    const cloud_cache::cloud* cloud = clouds.find(key);
+                    if (!cloud)
+                    {
+                        if (read_ply(c.ply_name.c_str(), raw))
+                        {
+                            fprintf(stderr, "Failed to read file %s\n", c.ply_name.c_str());
+                            if (serving)
+                                server.reply(c.png_name, "failed");
+                            progress.failed();
+                            continue;
+                        }
+
+                        timer.lap(sp, STAGE_PARSE);
+                        if (!ids_suffix.empty())
+                            filter_points(raw, points, vertices);
+                        else
+                            filter_points(raw, points);
+                        if (adaptive)
+                            point_spacing(points, spacing);
+                        timer.lap(sp, STAGE_FILTER);
+                        cloud = clouds.insert(key, points, raw.size()/3);
+                        timer.lap(sp, STAGE_UPLOAD);
+                        if (sp)
+                            s.bytes_read = file_size(c.ply_name);
+                    }
+                    if (sp)
+                    {
+                        s.points_loaded = cloud ? cloud->points_loaded : raw.size()/3;
+                        s.points_kept = cloud ? cloud->count : points.size()/3;
+                    }
+
+                    // clouds over the budget are drawn from memory like without the cache
+                    if (adaptive)
+                        img = gl_renderer.render(points.empty() ? NULL : &points[0], spacing.empty() ? NULL : &spacing[0],
+                            points.size()/3, mvp, glm::vec2(camera->K[0][0]*scale, camera->K[1][1]*scale), sp);
+                    else
+                        img = cloud ? gl_renderer.render(cloud->buffer, cloud->count, mvp, sp) : renderer.render(points, mvp, sp);
+                }
+                out_imgs.clear();
+                for (size_t k=0; k<scales.size(); k++)
+                    out_imgs.push_back(scale_level[k] < 0 ? img : renderer.read_level(scale_level[k], sp));
+                // the extra channels are full size only and written by npy_writer
+                out_writers.assign(out_imgs.size(), (output_writer*)NULL);
+                if (!ids_suffix.empty())
+                {
+                    // indices into the filtered points, mapped back to the ply's vertices
+                    cv::Mat ids = ctx ? gl_renderer.read_ids() : soft_renderer.read_ids();
+                    for (int y = 0; y < ids.rows; y++)
+                    {
+                        int* row = ids.ptr<int>(y);
+                        for (int x = 0; x < ids.cols; x++)
+                            if (row[x] >= 0)
+                                row[x] = vertices[row[x]];
+                    }
+                    out_imgs.push_back(ids);
+                    out_names.push_back(suffixed_name(c.png_name, ids_suffix));
+                    out_writers.push_back(npy_writer);
+                }
+                if (!normals_suffix.empty())
+                {
+                    out_imgs.push_back(gl_renderer.read_normals(sp));
+                    out_names.push_back(suffixed_name(c.png_name, normals_suffix));
+                    out_writers.push_back(npy_writer);
+                }
+                encoders.push(out_imgs, out_names, c.png_name, s, out_writers);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                cache_totals.hits += clouds.hits;
+                cache_totals.misses += clouds.misses;
+                cache_totals.evictions += clouds.evictions;
+                cache_totals.peak_bytes += clouds.peak_bytes;
+            }
+            clouds.clear();
+            scene.clear();
+            renderer.destroy();
+            if (ctx)
+                ctx->release();
+        }));
     }
+    for (auto& w:workers)
+        w.join();
+    encoders.finish();
+    delete writer;
+    delete npy_writer;
+    if (progress_interval > 0)
+        progress.summary();
+    if (stats.is_open())
+        stats.summary();
+    if (!cpu && gpu_cache_mb > 0)
+        printf("gpu cache: %ld hits, %ld misses, %ld evictions, %.1f MB peak\n",
+            cache_totals.hits, cache_totals.misses, cache_totals.evictions, cache_totals.peak_bytes/(1024.0*1024.0));
 
     
 
@@ -464,16 +761,9 @@ int main(int argc, char** argv)
     cv::imwrite("fuck.png",save_img_non_densified);
     */
 
-    // Properly de-allocate all resources once they've outlived their purpose
-    glDeleteVertexArrays(1, &vao);
-    glDeleteBuffers(1, &vbo);
-    //Delete resources
-    glDeleteTextures(1, &offline_tex);
-    glDeleteRenderbuffersEXT(1, &rbo);
-    //Bind 0, which means render to back buffer, as a result, fb is unbound
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-    glDeleteFramebuffersEXT(1, &fbo);
-    // Terminate GLFW, clearing any resources allocated by GLFW.
-    glfwTerminate();
-    return 0;
+    for (auto ctx:contexts)
+        delete ctx;
+    if (!cpu)
+        terminate_gl_platform();
+    return failed_workers > 0 ? -1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,386 @@
+#include "output.h"
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <fstream>
+#include <mutex>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool parse_output_format(const std::string& name, output_format& fmt)
+{
+    if (name == "png")
+        fmt = OUTPUT_PNG;
+    else if (name == "raw")
+        fmt = OUTPUT_RAW;
+    else if (name == "npy")
+        fmt = OUTPUT_NPY;
+    else if (name == "stack")
+        fmt = OUTPUT_STACK;
+    else
+        return false;
+    return true;
+}
+
+static const char* npy_descr(int cv_depth)
+{
+    switch (cv_depth)
+    {
+    case CV_8U: return "|u1";
+    case CV_16U: return "<u2";
+    case CV_32S: return "<i4";
+    case CV_32F: return "<f4";
+    default: return NULL;
+    }
+}
+
+std::string npy_header(int cv_depth, const std::vector<int>& shape, size_t min_len)
+{
+    std::ostringstream dict;
+    dict << "{'descr': '" << npy_descr(cv_depth) << "', 'fortran_order': False, 'shape': (";
+    for (size_t i = 0; i < shape.size(); i++)
+        dict << shape[i] << (shape.size() == 1 || i+1 < shape.size() ? ", " : "");
+    dict << "), }";
+
+    // magic(6) + version(2) + header_len(2) + dict + padding + '\n'
+    std::string d = dict.str();
+    size_t total = 10 + d.size() + 1;
+    if (total < min_len)
+        total = min_len;
+    total = (total + 63) / 64 * 64;
+    d.append(total - 10 - d.size() - 1, ' ');
+    d += '\n';
+
+    std::string h("\x93NUMPY\x01\x00", 8);
+    unsigned short len = (unsigned short)d.size();
+    h += (char)(len & 0xff);
+    h += (char)(len >> 8);
+    return h + d;
+}
+
+static std::string replace_extension(const std::string& name, const char* ext)
+{
+    size_t dot = name.find_last_of('.');
+    size_t slash = name.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return name + ext;
+    return name.substr(0, dot) + ext;
+}
+
+// files are written as "<name>.tmp" and renamed once complete, so an interrupted
+// run never leaves a truncated file under the final name
+static std::string temp_name(const std::string& name)
+{
+    return name + ".tmp";
+}
+
+static bool replace_file(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+static bool write_pixels(std::ofstream& out, const cv::Mat& img)
+{
+    size_t row_bytes = img.cols * img.elemSize();
+    if (img.isContinuous())
+        out.write((const char*)img.data, row_bytes * img.rows);
+    else
+        for (int r = 0; r < img.rows; r++)
+            out.write((const char*)img.ptr(r), row_bytes);
+    return out.good();
+}
+
+class png_writer : public output_writer
+{
+public:
+    png_writer(int png_level)
+    {
+        if (png_level >= 0)
+        {
+            params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+            params.push_back(png_level);
+        }
+    }
+    bool write(const cv::Mat& img, const std::string& key, size_t& bytes)
+    {
+        // encoded in memory since imwrite picks the format from the (temp) file name
+        std::vector<uchar> buf;
+        if (!cv::imencode(".png", img, buf, params))
+            return false;
+        std::ofstream out(temp_name(key).c_str(), std::ios::binary);
+        if (!out.is_open())
+            return false;
+        out.write((const char*)&buf[0], buf.size());
+        out.close();
+        bytes = buf.size();
+        return !out.fail() && replace_file(temp_name(key), key);
+    }
+    std::string output_path(const std::string& key)
+    {
+        return key;
+    }
+private:
+    std::vector<int> params;
+};
+
+class raw_writer : public output_writer
+{
+public:
+    raw_writer(bool npy) : npy(npy) {}
+    bool write(const cv::Mat& img, const std::string& key, size_t& bytes)
+    {
+        std::string path = output_path(key);
+        bytes = img.cols * img.elemSize() * img.rows;
+        std::ofstream out(temp_name(path).c_str(), std::ios::binary);
+        if (!out.is_open())
+            return false;
+        if (npy)
+        {
+            std::vector<int> shape;
+            shape.push_back(img.rows);
+            shape.push_back(img.cols);
+            if (img.channels() > 1)
+                shape.push_back(img.channels());
+            std::string h = npy_header(img.depth(), shape);
+            out.write(h.data(), h.size());
+            bytes += h.size();
+        }
+        if (!write_pixels(out, img))
+            return false;
+        out.close();
+        return !out.fail() && replace_file(temp_name(path), path);
+    }
+    std::string output_path(const std::string& key)
+    {
+        return replace_extension(key, npy ? ".npy" : ".raw");
+    }
+private:
+    bool npy;
+};
+
+// One (N, h, w) .npy file mapped into memory. Frames are copied into the next free
+// slot in completion order and "<stack>.idx" records key -> frame, byte offset.
+// The header reserves room for any N, it is rewritten with the final count on close.
+class stack_writer : public output_writer
+{
+public:
+    stack_writer(const std::string& path, size_t expected_frames)
+        : path(path), capacity(expected_frames > 0 ? expected_frames : 256), frames(0),
+          frame_bytes(0), header_len(0), base(NULL)
+#ifdef _WIN32
+        , file(INVALID_HANDLE_VALUE), mapping(NULL)
+#else
+        , fd(-1)
+#endif
+    {
+    }
+
+    ~stack_writer()
+    {
+        close();
+    }
+
+    bool write(const cv::Mat& img, const std::string& key, size_t& bytes)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!base)
+        {
+            rows = img.rows;
+            cols = img.cols;
+            depth = img.depth();
+            frame_bytes = img.cols * img.elemSize() * img.rows;
+            header_len = header(0).size();
+            index.open((path + ".idx").c_str());
+            if (!index.is_open() || !map(capacity))
+                return false;
+        }
+        if (img.rows != rows || img.cols != cols || img.depth() != depth)
+        {
+            fprintf(stderr, "stack %s: all frames must have the same size and type\n", path.c_str());
+            return false;
+        }
+        if (frames == capacity && !map(capacity*2))
+            return false;
+
+        size_t offset = header_len + frames*frame_bytes;
+        size_t row_bytes = img.cols * img.elemSize();
+        for (int r = 0; r < img.rows; r++)
+            memcpy(base + offset + r*row_bytes, img.ptr(r), row_bytes);
+        index << key << " " << frames << " " << offset << "\n";
+        frames++;
+        bytes = frame_bytes;
+        return true;
+    }
+
+    bool close()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!base)
+            return true;
+        std::string h = header(frames);
+        memcpy(base, h.data(), h.size());
+        unmap();
+        bool ok = resize_file(header_len + frames*frame_bytes);
+        close_file();
+        index.close();
+        return ok;
+    }
+
+private:
+    std::string header(size_t n)
+    {
+        std::vector<int> shape;
+        shape.push_back((int)n);
+        shape.push_back(rows);
+        shape.push_back(cols);
+        // fixed length so the count can grow without moving the frames
+        return npy_header(depth, shape, 128);
+    }
+
+#ifdef _WIN32
+    bool map(size_t n)
+    {
+        unmap();
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file == INVALID_HANDLE_VALUE)
+            {
+                fprintf(stderr, "cannot create stack %s\n", path.c_str());
+                return false;
+            }
+        }
+        size_t bytes = header_len + n*frame_bytes;
+        LARGE_INTEGER size;
+        size.QuadPart = (LONGLONG)bytes;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL);
+        if (mapping)
+            base = (char*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, bytes);
+        if (!base)
+        {
+            fprintf(stderr, "cannot map %lu bytes of stack %s\n", (unsigned long)bytes, path.c_str());
+            return false;
+        }
+        capacity = n;
+        return true;
+    }
+
+    void unmap()
+    {
+        if (base)
+            UnmapViewOfFile(base);
+        if (mapping)
+            CloseHandle(mapping);
+        base = NULL;
+        mapping = NULL;
+    }
+
+    bool resize_file(size_t bytes)
+    {
+        LARGE_INTEGER size;
+        size.QuadPart = (LONGLONG)bytes;
+        return SetFilePointerEx(file, size, NULL, FILE_BEGIN) && SetEndOfFile(file);
+    }
+
+    void close_file()
+    {
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+    }
+#else
+    bool map(size_t n)
+    {
+        unmap();
+        if (fd < 0)
+        {
+            fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+            {
+                fprintf(stderr, "cannot create stack %s\n", path.c_str());
+                return false;
+            }
+        }
+        size_t bytes = header_len + n*frame_bytes;
+        if (!resize_file(bytes))
+            return false;
+        void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            fprintf(stderr, "cannot map %lu bytes of stack %s\n", (unsigned long)bytes, path.c_str());
+            return false;
+        }
+        base = (char*)p;
+        mapped_bytes = bytes;
+        capacity = n;
+        return true;
+    }
+
+    void unmap()
+    {
+        if (base)
+            munmap(base, mapped_bytes);
+        base = NULL;
+    }
+
+    bool resize_file(size_t bytes)
+    {
+        return ftruncate(fd, (off_t)bytes) == 0;
+    }
+
+    void close_file()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+#endif
+
+    std::string path;
+    std::mutex mtx;
+    std::ofstream index;
+    size_t capacity, frames, frame_bytes, header_len;
+    int rows, cols, depth;
+    char* base;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#else
+    int fd;
+    size_t mapped_bytes;
+#endif
+};
+
+output_writer* create_output_writer(output_format fmt, int png_level,
+    const std::string& stack_path, size_t expected_frames)
+{
+    switch (fmt)
+    {
+    case OUTPUT_PNG: return new png_writer(png_level);
+    case OUTPUT_RAW: return new raw_writer(false);
+    case OUTPUT_NPY: return new raw_writer(true);
+    case OUTPUT_STACK:
+        if (stack_path.empty())
+        {
+            fprintf(stderr, "stack output needs --stack file.npy\n");
+            return NULL;
+        }
+        return new stack_writer(stack_path, expected_frames);
+    }
+    return NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <opencv2/core/core.hpp>
+
+#include <string>
+
+enum output_format
+{
+    OUTPUT_PNG,     // 16-bit png per job, png_name is the file name
+    OUTPUT_RAW,     // headerless row-major pixels, png_name with its extension replaced by .raw
+    OUTPUT_NPY,     // numpy .npy per job, png_name with its extension replaced by .npy
+    OUTPUT_STACK    // all jobs in one memory-mapped (N, h, w) .npy, png_name is only a key in its index
+};
+
+bool parse_output_format(const std::string& name, output_format& fmt);
+
+// Destination for rendered depth images. write() is called concurrently from
+// the encoder threads and reports how many bytes it stored; close() is called
+// once after the last write.
+class output_writer
+{
+public:
+    virtual ~output_writer() {}
+    virtual bool write(const cv::Mat& img, const std::string& key, size_t& bytes) = 0;
+    virtual bool close() { return true; }
+    // file that write() produces for key, empty if outputs are not separate files
+    virtual std::string output_path(const std::string& key) { return std::string(); }
+};
+
+// stack_path is only used by OUTPUT_STACK, expected_frames is a preallocation hint
+// for it (0 if unknown, the stack grows when more frames arrive). Returns NULL on failure.
+output_writer* create_output_writer(output_format fmt, int png_level,
+    const std::string& stack_path, size_t expected_frames);
+
+// numpy format 1.0 header for a C-ordered array of the given cv depth, padded to a
+// multiple of 64 bytes and at least min_len bytes long (so it can be rewritten in place)
+std::string npy_header(int cv_depth, const std::vector<int>& shape, size_t min_len = 0);
+
+#endif
@@ -0,0 +1,156 @@
+#include "progress.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+static unsigned long long key_hash(const std::string& key)
+{
+    // FNV-1a
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+job_journal::job_journal() : file(NULL)
+{
+}
+
+job_journal::~job_journal()
+{
+    if (file)
+        fclose(file);
+}
+
+bool job_journal::open(const std::string& path)
+{
+    // rewrite the journal without its torn tail to a temp file, then atomically replace it
+    std::string tmp = path + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out)
+    {
+        fprintf(stderr, "cannot write journal %s\n", tmp.c_str());
+        return false;
+    }
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::string key;
+    // a record counts only with its newline, a last line without one was torn
+    while (std::getline(in, key) && !in.eof())
+    {
+        if (key.empty())
+            continue;
+        done.push_back(key_hash(key));
+        fprintf(out, "%s\n", key.c_str());
+    }
+    in.close();
+    fclose(out);
+#ifdef _WIN32
+    if (!MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+#else
+    if (rename(tmp.c_str(), path.c_str()) != 0)
+#endif
+    {
+        fprintf(stderr, "cannot replace journal %s\n", path.c_str());
+        return false;
+    }
+
+    std::sort(done.begin(), done.end());
+    done.erase(std::unique(done.begin(), done.end()), done.end());
+
+    file = fopen(path.c_str(), "ab");
+    return file != NULL;
+}
+
+bool job_journal::contains(const std::string& key) const
+{
+    return std::binary_search(done.begin(), done.end(), key_hash(key));
+}
+
+void job_journal::record(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    fprintf(file, "%s\n", key.c_str());
+    fflush(file);
+}
+
+long long file_mtime(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return -1;
+    return (long long)st.st_mtime;
+}
+
+long long file_size(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return -1;
+    return (long long)st.st_size;
+}
+
+progress_meter::progress_meter(long total, double interval)
+    : total(total), n_done(0), n_skipped(0), n_failed(0), interval(interval)
+{
+    start = last = std::chrono::steady_clock::now();
+}
+
+void progress_meter::done()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    n_done++;
+    report(false);
+}
+
+void progress_meter::skipped()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    n_skipped++;
+    report(false);
+}
+
+void progress_meter::failed()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    n_failed++;
+    report(false);
+}
+
+void progress_meter::summary()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    report(true);
+}
+
+void progress_meter::report(bool force)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!force && (interval <= 0 || std::chrono::duration<double>(now - last).count() < interval))
+        return;
+    last = now;
+
+    double elapsed = std::chrono::duration<double>(now - start).count();
+    // skipped jobs cost almost nothing, only rendered ones predict the rest
+    double rate = elapsed > 0 ? n_done / elapsed : 0.0;
+    long finished = n_done + n_skipped + n_failed;
+    printf("progress: %ld done, %ld skipped, %ld failed", n_done, n_skipped, n_failed);
+    if (total >= 0)
+        printf(" of %ld", total);
+    printf(", %.1f jobs/s", rate);
+    if (total >= 0 && rate > 0 && !force)
+    {
+        long eta = (long)((total - finished) / rate);
+        printf(", eta %ld:%02ld:%02ld", eta/3600, eta/60%60, eta%60);
+    }
+    printf(", %.0fs elapsed\n", elapsed);
+    fflush(stdout);
+}
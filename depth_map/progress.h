@@ -0,0 +1,59 @@
+#ifndef __PROGRESS_H__
+#define __PROGRESS_H__
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdio>
+#include <chrono>
+
+// Outputs finished by earlier runs of a batch, for --resume. The file holds one
+// output key per line. At startup it is loaded and rewritten without a torn last
+// line to a temp file that is renamed over the old one; afterwards every finished
+// output is appended and flushed, so a crash can only tear the line being written.
+class job_journal
+{
+public:
+    job_journal();
+    ~job_journal();
+
+    bool open(const std::string& path);
+    // true if key was finished by an earlier run
+    bool contains(const std::string& key) const;
+    void record(const std::string& key);
+    size_t finished_before() const { return done.size(); }
+
+private:
+    // 64-bit hashes of the keys, sorted; 8 bytes per job however long the names are
+    std::vector<unsigned long long> done;
+    std::mutex mtx;
+    FILE* file;
+};
+
+// seconds since the epoch of the file's last modification, -1 if it does not exist
+long long file_mtime(const std::string& path);
+// size in bytes, -1 if the file does not exist
+long long file_size(const std::string& path);
+
+// Counts finished, skipped and failed jobs and prints throughput and an ETA at most
+// every interval seconds. total < 0 if unknown.
+class progress_meter
+{
+public:
+    progress_meter(long total, double interval);
+
+    void done();
+    void skipped();
+    void failed();
+    void summary();
+
+private:
+    void report(bool force);
+
+    std::mutex mtx;
+    long total, n_done, n_skipped, n_failed;
+    double interval;
+    std::chrono::steady_clock::time_point start, last;
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include "project.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define PROJECT_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define PROJECT_NEON_BUILD
+#include <arm_neon.h>
+#endif
+
+// gcc and clang only emit avx2 inside functions that ask for it, msvc always does
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE __attribute__((target("sse2")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE
+#endif
+
+static void project_scalar(const glm::mat4& m, const float* x, const float* y, const float* z, size_t begin, size_t n,
+    float hw, float hh, float* sx, float* sy, float* cz, float* cw)
+{
+    for (size_t i = begin; i < n; i++)
+    {
+        float xc = m[0][0]*x[i] + m[1][0]*y[i] + m[2][0]*z[i] + m[3][0];
+        float yc = m[0][1]*x[i] + m[1][1]*y[i] + m[2][1]*z[i] + m[3][1];
+        float zc = m[0][2]*x[i] + m[1][2]*y[i] + m[2][2]*z[i] + m[3][2];
+        float wc = m[0][3]*x[i] + m[1][3]*y[i] + m[2][3]*z[i] + m[3][3];
+        sx[i] = (xc/wc + 1.0f)*hw;
+        sy[i] = (yc/wc + 1.0f)*hh;
+        cz[i] = zc;
+        cw[i] = wc;
+    }
+}
+
+#ifdef PROJECT_X86
+
+TARGET_SSE
+static void project_sse(const glm::mat4& m, const float* x, const float* y, const float* z, size_t n,
+    float hw, float hh, float* sx, float* sy, float* cz, float* cw)
+{
+    __m128 c[4][4];
+    for (int col = 0; col < 4; col++)
+        for (int row = 0; row < 4; row++)
+            c[col][row] = _mm_set1_ps(m[col][row]);
+    const __m128 one = _mm_set1_ps(1.0f), vhw = _mm_set1_ps(hw), vhh = _mm_set1_ps(hh);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+        __m128 r[4];
+        for (int row = 0; row < 4; row++)
+            r[row] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0][row], px), _mm_mul_ps(c[1][row], py)),
+                _mm_mul_ps(c[2][row], pz)), c[3][row]);
+        _mm_storeu_ps(sx + i, _mm_mul_ps(_mm_add_ps(_mm_div_ps(r[0], r[3]), one), vhw));
+        _mm_storeu_ps(sy + i, _mm_mul_ps(_mm_add_ps(_mm_div_ps(r[1], r[3]), one), vhh));
+        _mm_storeu_ps(cz + i, r[2]);
+        _mm_storeu_ps(cw + i, r[3]);
+    }
+    project_scalar(m, x, y, z, i, n, hw, hh, sx, sy, cz, cw);
+}
+
+TARGET_AVX2
+static void project_avx2(const glm::mat4& m, const float* x, const float* y, const float* z, size_t n,
+    float hw, float hh, float* sx, float* sy, float* cz, float* cw)
+{
+    __m256 c[4][4];
+    for (int col = 0; col < 4; col++)
+        for (int row = 0; row < 4; row++)
+            c[col][row] = _mm256_set1_ps(m[col][row]);
+    const __m256 one = _mm256_set1_ps(1.0f), vhw = _mm256_set1_ps(hw), vhh = _mm256_set1_ps(hh);
+
+    // no fma: the products are rounded like in the other paths
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+        __m256 r[4];
+        for (int row = 0; row < 4; row++)
+            r[row] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[0][row], px), _mm256_mul_ps(c[1][row], py)),
+                _mm256_mul_ps(c[2][row], pz)), c[3][row]);
+        _mm256_storeu_ps(sx + i, _mm256_mul_ps(_mm256_add_ps(_mm256_div_ps(r[0], r[3]), one), vhw));
+        _mm256_storeu_ps(sy + i, _mm256_mul_ps(_mm256_add_ps(_mm256_div_ps(r[1], r[3]), one), vhh));
+        _mm256_storeu_ps(cz + i, r[2]);
+        _mm256_storeu_ps(cw + i, r[3]);
+    }
+    project_scalar(m, x, y, z, i, n, hw, hh, sx, sy, cz, cw);
+}
+
+static bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    // the os must save the ymm registers too
+    bool osxsave = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+    if (!osxsave || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+// detected once before main: cpu_renderer's threads all reach the dispatch at once on
+// their first render, and VS2012 does not initialize function statics thread safely
+static const bool has_avx2 = cpu_has_avx2();
+
+#endif
+
+#ifdef PROJECT_NEON_BUILD
+
+static void project_neon(const glm::mat4& m, const float* x, const float* y, const float* z, size_t n,
+    float hw, float hh, float* sx, float* sy, float* cz, float* cw)
+{
+    float32x4_t c[4][4];
+    for (int col = 0; col < 4; col++)
+        for (int row = 0; row < 4; row++)
+            c[col][row] = vdupq_n_f32(m[col][row]);
+    const float32x4_t one = vdupq_n_f32(1.0f), vhw = vdupq_n_f32(hw), vhh = vdupq_n_f32(hh);
+
+    // vmulq + vaddq rather than vfmaq, for the same rounding as the other paths
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        float32x4_t px = vld1q_f32(x + i), py = vld1q_f32(y + i), pz = vld1q_f32(z + i);
+        float32x4_t r[4];
+        for (int row = 0; row < 4; row++)
+            r[row] = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(c[0][row], px), vmulq_f32(c[1][row], py)),
+                vmulq_f32(c[2][row], pz)), c[3][row]);
+        vst1q_f32(sx + i, vmulq_f32(vaddq_f32(vdivq_f32(r[0], r[3]), one), vhw));
+        vst1q_f32(sy + i, vmulq_f32(vaddq_f32(vdivq_f32(r[1], r[3]), one), vhh));
+        vst1q_f32(cz + i, r[2]);
+        vst1q_f32(cw + i, r[3]);
+    }
+    project_scalar(m, x, y, z, i, n, hw, hh, sx, sy, cz, cw);
+}
+
+#endif
+
+bool project_isa_supported(project_isa isa)
+{
+    switch (isa)
+    {
+    case PROJECT_SCALAR: return true;
+#ifdef PROJECT_X86
+    case PROJECT_SSE: return true;
+    case PROJECT_AVX2: return has_avx2;
+#endif
+#ifdef PROJECT_NEON_BUILD
+    case PROJECT_NEON: return true;
+#endif
+    default: return false;
+    }
+}
+
+// after has_avx2, which it reads, in initialization order
+static const project_isa best_isa =
+    project_isa_supported(PROJECT_AVX2) ? PROJECT_AVX2 :
+    project_isa_supported(PROJECT_NEON) ? PROJECT_NEON :
+    project_isa_supported(PROJECT_SSE) ? PROJECT_SSE : PROJECT_SCALAR;
+
+project_isa project_best_isa()
+{
+    return best_isa;
+}
+
+const char* project_isa_name(project_isa isa)
+{
+    switch (isa)
+    {
+    case PROJECT_SCALAR: return "scalar";
+    case PROJECT_SSE: return "sse";
+    case PROJECT_AVX2: return "avx2";
+    case PROJECT_NEON: return "neon";
+    }
+    return "unknown";
+}
+
+void project_points(const glm::mat4& mvp, const float* x, const float* y, const float* z, size_t n,
+    int width, int height, float* sx, float* sy, float* cz, float* cw)
+{
+    project_points(project_best_isa(), mvp, x, y, z, n, width, height, sx, sy, cz, cw);
+}
+
+void project_points(project_isa isa, const glm::mat4& mvp, const float* x, const float* y, const float* z, size_t n,
+    int width, int height, float* sx, float* sy, float* cz, float* cw)
+{
+    float hw = 0.5f*width, hh = 0.5f*height;
+    switch (isa)
+    {
+#ifdef PROJECT_X86
+    case PROJECT_SSE: project_sse(mvp, x, y, z, n, hw, hh, sx, sy, cz, cw); return;
+    case PROJECT_AVX2: project_avx2(mvp, x, y, z, n, hw, hh, sx, sy, cz, cw); return;
+#endif
+#ifdef PROJECT_NEON_BUILD
+    case PROJECT_NEON: project_neon(mvp, x, y, z, n, hw, hh, sx, sy, cz, cw); return;
+#endif
+    default: project_scalar(mvp, x, y, z, 0, n, hw, hh, sx, sy, cz, cw); return;
+    }
+}
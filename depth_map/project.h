@@ -0,0 +1,36 @@
+#ifndef __PROJECT_H__
+#define __PROJECT_H__
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// Batched point projection by a getMVP matrix for the cpu side (the cpu renderer,
+// culling, visibility checks). Points come as separate x, y and z arrays; every
+// point gets its window position in a width x height viewport (pixel centers at
+// +0.5, rows as rendered) and its clip z and w. sx/sy are meaningless where w <= 0;
+// the point is inside the near/far planes iff -w <= z <= w.
+//
+// Each isa evaluates the same mul/add sequence in the same order as glm's mat4*vec4
+// (no fma), so they agree to the last bit unless the compiler contracts the scalar
+// code into fma itself. Outputs may not alias inputs.
+enum project_isa
+{
+    PROJECT_SCALAR,
+    PROJECT_SSE,
+    PROJECT_AVX2,
+    PROJECT_NEON
+};
+
+// widest isa this cpu supports, detected once
+project_isa project_best_isa();
+bool project_isa_supported(project_isa isa);
+const char* project_isa_name(project_isa isa);
+
+void project_points(const glm::mat4& mvp, const float* x, const float* y, const float* z, size_t n,
+    int width, int height, float* sx, float* sy, float* cz, float* cw);
+// a given isa, which must be supported; for benchmarks and comparisons
+void project_points(project_isa isa, const glm::mat4& mvp, const float* x, const float* y, const float* z, size_t n,
+    int width, int height, float* sx, float* sy, float* cz, float* cw);
+
+#endif
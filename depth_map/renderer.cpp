@@ -0,0 +1,826 @@
+#include "renderer.h"
+
+#include <algorithm>
+
+// both squares are +-patchsize in clip space
+static const float patchsize = 0.8f;
+
+bool parse_splat_path(const std::string& name, splat_path& path)
+{
+    if (name == "geometry")
+        path = SPLAT_GEOMETRY;
+    else if (name == "instanced")
+        path = SPLAT_INSTANCED;
+    else if (name == "compute")
+        path = SPLAT_COMPUTE;
+    else
+        return false;
+    return true;
+}
+
+bool parse_target(const std::string& name, bool& depth_only)
+{
+    if (name == "color")
+        depth_only = false;
+    else if (name == "depth")
+        depth_only = true;
+    else
+        return false;
+    return true;
+}
+
+bool parse_batch_submit(const std::string& name, batch_submit& submit)
+{
+    if (name == "multi")
+        submit = BATCH_MULTI_DRAW;
+    else if (name == "loop")
+        submit = BATCH_PER_CLOUD;
+    else
+        return false;
+    return true;
+}
+
+depth_renderer::depth_renderer(splat_path path, bool depth_only)
+    : path(path), width(0), height(0), float_output(false),
+      vao(0), vbo(0), offline_tex(0), fbo(0), rbo(0), shaderProgram(0),
+      depth_only(depth_only && path != SPLAT_COMPUTE), depth_tex(0), resolve_fbo(0), linearProgram(0),
+      corner_vbo(0), nearest_tex(0), splatProgram(0), resolveProgram(0),
+      adaptive_scale(1.0f), adaptive_max(16.0f), spacing_vbo(0), adaptive_vao(0), adaptiveProgram(0),
+      batch_vao(0), batchProgram(0),
+      fill_threshold(0.0f), fillProgram(0),
+      id_tex(0), normal_tex(0), normal_fbo(0), normalProgram(0),
+      pool_vao(0), poolProgram(0)
+{
+}
+
+GLuint depth_renderer::create_target(int width, int height)
+{
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // single channel 16-bit target: depth.frag writes the final png value,
+    // so the readback is 2 bytes per pixel and needs no conversion on the cpu.
+    // --dtype f32 keeps the unquantized value in a float target instead
+    if (float_output)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0,
+            GL_RED, GL_FLOAT, 0);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, width, height, 0,
+            GL_RED_INTEGER, GL_UNSIGNED_SHORT, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return tex;
+}
+
+cv::Mat depth_renderer::read_target(int width, int height)
+{
+    // rows are already top-down and values already quantized, read straight into the png buffer.
+    // a fresh buffer per job: the encoder owns it until the file is written
+    cv::Mat img(height, width, float_output ? CV_32FC1 : CV_16UC1);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    if (float_output)
+        glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, img.data);
+    else
+        glReadPixels(0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_SHORT, img.data);
+    return img;
+}
+
+bool depth_renderer::init(int width, int height, bool float_output)
+{
+    this->width = width;
+    this->height = height;
+    this->float_output = float_output;
+
+    // Enable depth test
+    glEnable(GL_DEPTH_TEST);
+    // Accept fragment if it closer to the camera than the former one
+    glDepthFunc(GL_LESS);
+
+
+    //vao
+    glGenVertexArrays(1, &vao);
+
+    //vbo
+    glGenBuffers(1, &vbo);
+
+    glBindVertexArray(vao);
+
+    // 1rst attribute buffer : vertices
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glVertexAttribPointer(
+        0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
+        3,                  // size
+        GL_FLOAT,           // type
+        GL_FALSE,           // normalized?
+        0,                  // stride
+        (void*)0            // array buffer offset
+        );
+
+    // the instanced path reads the point once per quad and the corner per vertex,
+    // in depth.geo's emit order: bottom-left, bottom-right, top-left, top-right
+    if (path == SPLAT_INSTANCED)
+    {
+        const GLfloat corners[8] = {-1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
+        glVertexAttribDivisor(0, 1);
+        glGenBuffers(1, &corner_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, corner_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    }
+
+    // Note that this is allowed, the call to glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
+    glBindBuffer(GL_ARRAY_BUFFER, 0); 
+
+    // Unbind VAO (it's always a good thing to unbind any buffer/array to prevent strange bugs)
+    glBindVertexArray(0); 
+
+
+    //////THE OFFLINE RENDERING
+    // create a texture object
+    offline_tex = create_target(width, height);
+    
+    // the downsample passes draw a full screen triangle without attributes,
+    // core profiles still need some vao bound for that
+    glGenVertexArrays(1, &pool_vao);
+
+    if (depth_only && !init_depth_only())
+        return false;
+
+    // create a framebuffer object
+    // (core entry points: core profile contexts, e.g. mesa's, do not expose EXT_framebuffer_object)
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    if (depth_only)
+    {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_tex, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    else
+    {
+        // create a renderbuffer object to store depth info
+        glGenRenderbuffers(1, &rbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
+            width, height);
+
+
+        // attach the texture to FBO color attachment point
+        glFramebufferTexture2D(GL_FRAMEBUFFER,        // 1. fbo target: GL_FRAMEBUFFER 
+            GL_COLOR_ATTACHMENT0,  // 2. attachment point
+            GL_TEXTURE_2D,         // 3. tex target: GL_TEXTURE_2D
+            offline_tex,             // 4. tex ID
+            0);                    // 5. mipmap level: 0(base)
+
+        // attach the renderbuffer to depth attachment point
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER,      // 1. fbo target: GL_FRAMEBUFFER
+            GL_DEPTH_ATTACHMENT, // 2. attachment point
+            GL_RENDERBUFFER,     // 3. rbo target: GL_RENDERBUFFER
+            rbo);              // 4. rbo ID
+    }
+
+    // check FBO status
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if(status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cout <<"cannot create fbo ext";
+        return false;
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    if (path == SPLAT_COMPUTE)
+        return init_compute();
+    return load_splat_program();
+}
+
+bool depth_renderer::load_splat_program()
+{
+    glDeleteProgram(shaderProgram);
+    // Create and compile our GLSL program from the shaders
+    if (path == SPLAT_INSTANCED)
+        shaderProgram = LoadShaders("./shaders/depth_quad.vert", fragment_shader());
+    else
+        shaderProgram = LoadShaders("./shaders/depth.vert", fragment_shader(), "./shaders/depth.geo");
+    if (!shaderProgram)
+        return false;
+    // Get a handle for our "MVP" uniform
+    // Only during the initialisation
+    MatrixID = glGetUniformLocation(shaderProgram, "MVP");
+    patchsizeID = glGetUniformLocation(shaderProgram, "patchsize");
+    return true;
+}
+
+const char* depth_renderer::fragment_shader() const
+{
+    if (depth_only)
+        return "./shaders/depth_only.frag";
+    if (id_tex)
+        return float_output ? "./shaders/depth_id_f32.frag" : "./shaders/depth_id.frag";
+    return float_output ? "./shaders/depth_f32.frag" : "./shaders/depth.frag";
+}
+
+bool depth_renderer::init_depth_only()
+{
+    linearProgram = LoadShaders("./shaders/depth_pool.vert",
+        float_output ? "./shaders/depth_linear_f32.frag" : "./shaders/depth_linear.frag");
+    if (!linearProgram)
+        return false;
+
+    // cleared to 1.0, the far plane, which depth_linear.frag turns into 0
+    glGenTextures(1, &depth_tex);
+    glBindTexture(GL_TEXTURE_2D, depth_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &resolve_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, resolve_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, offline_tex, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cout <<"cannot create the resolve fbo\n";
+        return false;
+    }
+    return true;
+}
+
+bool depth_renderer::init_compute()
+{
+    if (!GLEW_VERSION_4_3 && !(GLEW_ARB_compute_shader && GLEW_ARB_shader_image_load_store))
+    {
+        fprintf(stderr, "--splat compute needs GL 4.3 compute shaders\n");
+        return false;
+    }
+
+    // starts empty, the resolve pass empties it again after every render
+    const GLuint empty = 0xffffffffu;
+    glGenTextures(1, &nearest_tex);
+    glBindTexture(GL_TEXTURE_2D, nearest_tex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glClearTexImage(nearest_tex, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &empty);
+
+    splatProgram = LoadComputeShader("./shaders/depth_splat.comp");
+    resolveProgram = LoadComputeShader(float_output ? "./shaders/depth_resolve_f32.comp" : "./shaders/depth_resolve.comp");
+    if (!splatProgram || !resolveProgram)
+        return false;
+    splatMatrixID = glGetUniformLocation(splatProgram, "MVP");
+    splatPatchsizeID = glGetUniformLocation(splatProgram, "patchsize");
+    splatCountID = glGetUniformLocation(splatProgram, "count");
+    return true;
+}
+
+int depth_renderer::add_level(int width, int height)
+{
+    if (!poolProgram)
+    {
+        poolProgram = LoadShaders("./shaders/depth_pool.vert",
+            float_output ? "./shaders/depth_pool_f32.frag" : "./shaders/depth_pool.frag");
+        if (!poolProgram)
+            return -1;
+        ratioID = glGetUniformLocation(poolProgram, "ratio");
+    }
+
+    level l;
+    l.width = width;
+    l.height = height;
+    l.tex = create_target(width, height);
+    glGenFramebuffers(1, &l.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, l.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, l.tex, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    levels.push_back(l);
+    if(status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cout <<"cannot create fbo for a "<<width<<"x"<<height<<" level\n";
+        return -1;
+    }
+    return (int)levels.size()-1;
+}
+
+cv::Mat depth_renderer::read_level(int i, job_stats* stats)
+{
+    stage_timer timer;
+    const level& l = levels[i];
+
+    glBindFramebuffer(GL_FRAMEBUFFER, l.fbo);
+    glViewport(0, 0, l.width, l.height);
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(poolProgram);
+    glUniform2f(ratioID, (float)width/l.width, (float)height/l.height);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, offline_tex);
+    glBindVertexArray(pool_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glEnable(GL_DEPTH_TEST);
+#ifndef DEPTH_MAP_NO_STATS
+    if (stats)
+        glFinish();
+#endif
+    timer.lap(stats, STAGE_DRAW);
+
+    cv::Mat img = read_target(l.width, l.height);
+    timer.lap(stats, STAGE_READBACK);
+    return img;
+}
+
+cv::Mat depth_renderer::render(const GLfloat* xyz, size_t count, const glm::mat4& mvp, job_stats* stats)
+{
+    stage_timer timer;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*3*count, xyz, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0); 
+    timer.lap(stats, STAGE_UPLOAD);
+    return render(vbo, (GLsizei)count, mvp, stats);
+}
+
+void depth_renderer::splat_compute(GLuint buffer, GLsizei count, const glm::mat4& mvp)
+{
+    glUseProgram(splatProgram);
+    glUniformMatrix4fv(splatMatrixID, 1, GL_FALSE, &mvp[0][0]);
+    glUniform1f(splatPatchsizeID, patchsize);
+    glUniform1ui(splatCountID, (GLuint)count);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+    glBindImageTexture(0, nearest_tex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    // 256 points per group; beyond the guaranteed 65535 groups invocations loop
+    GLuint groups = std::min(((GLuint)count + 255)/256, 65535u);
+    if (groups > 0)
+        glDispatchCompute(groups, 1, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    glUseProgram(resolveProgram);
+    glBindImageTexture(1, offline_tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, float_output ? GL_R32F : GL_R16UI);
+    glDispatchCompute((width + 15)/16, (height + 15)/16, 1);
+    // read back through the fbo, or sampled by the min-pool pass
+    glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+}
+
+void depth_renderer::begin_target(bool clear)
+{
+    // the downsample passes leave their own fbo bound
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+    if (!clear)
+        return;
+    if (depth_only)
+    {
+        glClear(GL_DEPTH_BUFFER_BIT);
+        return;
+    }
+
+    // glClear is undefined on integer colour buffers
+    const GLuint clear_depth[4] = {0, 0, 0, 0};
+    const GLfloat clear_depthf[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    if (float_output)
+        glClearBufferfv(GL_COLOR, 0, clear_depthf);
+    else
+        glClearBufferuiv(GL_COLOR, 0, clear_depth);
+    if (id_tex)
+    {
+        const GLuint no_point[4] = {0xffffffffu, 0, 0, 0};
+        glClearBufferuiv(GL_COLOR, 1, no_point);
+    }
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void depth_renderer::resolve_depth()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, resolve_fbo);
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(linearProgram);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depth_tex);
+    glBindVertexArray(pool_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+cv::Mat depth_renderer::finish_target(stage_timer& timer, job_stats* stats)
+{
+    // leaves resolve_fbo bound for read_target
+    if (depth_only)
+        resolve_depth();
+    fill_holes();
+#ifndef DEPTH_MAP_NO_STATS
+    if (stats)
+        glFinish();
+#endif
+    timer.lap(stats, STAGE_DRAW);
+
+    cv::Mat save_img_densified = read_target(width, height);
+    timer.lap(stats, STAGE_READBACK);
+    return save_img_densified;
+}
+
+cv::Mat depth_renderer::render(GLuint buffer, GLsizei count, const glm::mat4& mvp, job_stats* stats)
+{
+    stage_timer timer;
+    last_mvp = mvp;
+
+    // the compute resolve writes every pixel, nothing to clear
+    begin_target(path != SPLAT_COMPUTE);
+    if (path == SPLAT_COMPUTE)
+    {
+        splat_compute(buffer, count, mvp);
+        return finish_target(timer, stats);
+    }
+
+    // Use our shader
+    glUseProgram(shaderProgram);
+    
+    // Send our transformation to the currently bound shader, in the "MVP" uniform
+    // This is done in the main loop since each model will have a different MVP matrix (At least for the M part)
+    glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &mvp[0][0]);
+    glUniform1f(patchsizeID, patchsize);
+
+
+    // attribute 0 reads from whichever buffer holds the cloud
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (path == SPLAT_INSTANCED)
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    else
+        glDrawArrays(GL_POINTS, 0, count); 
+    glBindVertexArray(0);
+    return finish_target(timer, stats);
+}
+
+void depth_renderer::set_adaptive(float scale, float max_px)
+{
+    adaptive_scale = scale;
+    adaptive_max = max_px;
+}
+
+bool depth_renderer::init_adaptive()
+{
+    adaptiveProgram = LoadShaders("./shaders/depth_adaptive.vert", fragment_shader(), "./shaders/depth_adaptive.geo");
+    if (!adaptiveProgram)
+        return false;
+    adaptiveMatrixID = glGetUniformLocation(adaptiveProgram, "MVP");
+    focalID = glGetUniformLocation(adaptiveProgram, "focal");
+    viewportID = glGetUniformLocation(adaptiveProgram, "viewport");
+    splatScaleID = glGetUniformLocation(adaptiveProgram, "splat_scale");
+    splatMinID = glGetUniformLocation(adaptiveProgram, "splat_min");
+    splatMaxID = glGetUniformLocation(adaptiveProgram, "splat_max");
+
+    // positions from the same vbo as the fixed path, spacings from their own
+    glGenBuffers(1, &spacing_vbo);
+    glGenVertexArrays(1, &adaptive_vao);
+    glBindVertexArray(adaptive_vao);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ARRAY_BUFFER, spacing_vbo);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    return true;
+}
+
+cv::Mat depth_renderer::render(const GLfloat* xyz, const GLfloat* spacing, size_t count, const glm::mat4& mvp,
+    const glm::vec2& focal, job_stats* stats)
+{
+    stage_timer timer;
+    if (!adaptiveProgram && !init_adaptive())
+        return cv::Mat();
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*3*count, xyz, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, spacing_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*count, spacing, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    timer.lap(stats, STAGE_UPLOAD);
+    last_mvp = mvp;
+
+    begin_target(true);
+    glUseProgram(adaptiveProgram);
+    glUniformMatrix4fv(adaptiveMatrixID, 1, GL_FALSE, &mvp[0][0]);
+    glUniform2f(focalID, focal.x, focal.y);
+    glUniform2f(viewportID, (float)width, (float)height);
+    glUniform1f(splatScaleID, adaptive_scale);
+    glUniform1f(splatMinID, 0.5f);
+    glUniform1f(splatMaxID, adaptive_max);
+    glBindVertexArray(adaptive_vao);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)count);
+    glBindVertexArray(0);
+    return finish_target(timer, stats);
+}
+
+bool depth_renderer::init_batch()
+{
+    batchProgram = LoadShaders("./shaders/depth_multi.vert", fragment_shader(), "./shaders/depth.geo");
+    if (!batchProgram)
+        return false;
+    batchMatrixID = glGetUniformLocation(batchProgram, "MVP");
+    batchPatchsizeID = glGetUniformLocation(batchProgram, "patchsize");
+    glGenVertexArrays(1, &batch_vao);
+    glBindVertexArray(batch_vao);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+    return true;
+}
+
+cv::Mat depth_renderer::render(const cloud_batch& batch, const glm::mat4& mvp, batch_submit submit, job_stats* stats)
+{
+    stage_timer timer;
+    if (!batchProgram && !init_batch())
+        return cv::Mat();
+    last_mvp = mvp;
+
+    begin_target(true);
+    glUseProgram(batchProgram);
+    glUniformMatrix4fv(batchMatrixID, 1, GL_FALSE, &mvp[0][0]);
+    glUniform1f(batchPatchsizeID, patchsize);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, batch.model_buffer);
+    glBindVertexArray(batch_vao);
+    if (submit == BATCH_MULTI_DRAW)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+        glBindBuffer(GL_ARRAY_BUFFER, batch.draw_id_buffer);
+        glEnableVertexAttribArray(2);
+        glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, 0, (void*)0);
+        glVertexAttribDivisor(2, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.command_buffer);
+        glMultiDrawArraysIndirect(GL_POINTS, (void*)0, (GLsizei)batch.clouds(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    else
+    {
+        // what the clouds cost one by one: an upload and a draw each, the index as a
+        // constant attribute instead of the draw_id array
+        glDisableVertexAttribArray(2);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        for (size_t i = 0; i < batch.clouds(); i++)
+        {
+            const cloud_batch::range& r = batch.cloud_ranges()[i];
+            if (r.count == 0)
+                continue;
+            glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*3*r.count, batch.cloud_points(i), GL_STREAM_DRAW);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+            glVertexAttribI1ui(2, (GLuint)i);
+            glDrawArrays(GL_POINTS, 0, (GLsizei)r.count);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    glBindVertexArray(0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    return finish_target(timer, stats);
+}
+
+bool depth_renderer::set_fill(int levels, float threshold)
+{
+    glDeleteTextures((GLsizei)fill_tex.size(), fill_tex.empty() ? NULL : &fill_tex[0]);
+    fill_tex.clear();
+    if (levels <= 0)
+        return true;
+    if (!GLEW_VERSION_4_3 && !(GLEW_ARB_compute_shader && GLEW_ARB_shader_image_load_store))
+    {
+        fprintf(stderr, "--fill needs GL 4.3 compute shaders\n");
+        return false;
+    }
+    if (!fillProgram && !(fillProgram = LoadComputeShader("./shaders/depth_fill.comp")))
+        return false;
+
+    // the f32 target holds png units/10000
+    fill_threshold = float_output ? threshold/10000.0f : threshold;
+    int w = width, h = height;
+    for (int i = 0; i <= levels; i++)
+    {
+        GLuint tex;
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, w, h);
+        fill_tex.push_back(tex);
+        w = (w + 1)/2;
+        h = (h + 1)/2;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
+
+void depth_renderer::fill_holes()
+{
+    if (fill_tex.empty())
+        return;
+    glUseProgram(fillProgram);
+    glUniform1i(glGetUniformLocation(fillProgram, "float_output"), float_output ? 1 : 0);
+    glUniform1f(glGetUniformLocation(fillProgram, "threshold"), fill_threshold);
+    glUniform1f(glGetUniformLocation(fillProgram, "min_coverage"), 0.5f);
+    GLint passID = glGetUniformLocation(fillProgram, "pass");
+    if (float_output)
+        glBindImageTexture(3, offline_tex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+    else
+        glBindImageTexture(2, offline_tex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R16UI);
+
+    int levels = (int)fill_tex.size() - 1;
+    // level sizes, rounded up at every halving
+    std::vector<int> w(1, width), h(1, height);
+    for (int i = 0; i < levels; i++)
+    {
+        w.push_back((w[i] + 1)/2);
+        h.push_back((h[i] + 1)/2);
+    }
+
+    // pass, fine level, coarse level (or -1), level whose pixels are visited
+    struct step { int pass, fine, coarse, grid; };
+    std::vector<step> steps;
+    step load = {0, 0, -1, 0};
+    steps.push_back(load);
+    for (int i = 0; i < levels; i++)
+    {
+        step pull = {1, i, i+1, i+1};
+        steps.push_back(pull);
+    }
+    for (int i = levels-1; i >= 0; i--)
+    {
+        step push = {2, i, i+1, i};
+        steps.push_back(push);
+    }
+    step store = {3, 0, -1, 0};
+    steps.push_back(store);
+
+    for (size_t k = 0; k < steps.size(); k++)
+    {
+        const step& s = steps[k];
+        glUniform1i(passID, s.pass);
+        glBindImageTexture(0, fill_tex[s.fine], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32F);
+        if (s.coarse >= 0)
+            glBindImageTexture(1, fill_tex[s.coarse], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32F);
+        glDispatchCompute((w[s.grid] + 15)/16, (h[s.grid] + 15)/16, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    // read back through the fbo, or sampled by the min-pool pass
+    glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+bool depth_renderer::set_channels(bool normals, bool ids)
+{
+    if (ids && !id_tex)
+    {
+        if (depth_only || path == SPLAT_COMPUTE)
+        {
+            fprintf(stderr, "point ids need the color target and a drawing splat path\n");
+            return false;
+        }
+        glGenTextures(1, &id_tex);
+        glBindTexture(GL_TEXTURE_2D, id_tex);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, width, height);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, id_tex, 0);
+        const GLenum buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, buffers);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout <<"cannot attach the point id target\n";
+            return false;
+        }
+        // the splat programs now write both attachments, adaptive and batch ones are
+        // loaded again when used
+        glDeleteProgram(adaptiveProgram);
+        adaptiveProgram = 0;
+        glDeleteProgram(batchProgram);
+        batchProgram = 0;
+        glDeleteVertexArrays(1, &batch_vao);
+        batch_vao = 0;
+        if (!load_splat_program())
+            return false;
+    }
+    if (normals && !normal_tex)
+    {
+        normalProgram = LoadShaders("./shaders/depth_pool.vert", "./shaders/depth_normal.frag");
+        if (!normalProgram)
+            return false;
+        glGenTextures(1, &normal_tex);
+        glBindTexture(GL_TEXTURE_2D, normal_tex);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenFramebuffers(1, &normal_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, normal_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, normal_tex, 0);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout <<"cannot create the normal fbo\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+cv::Mat depth_renderer::read_ids()
+{
+    if (!id_tex)
+        return cv::Mat();
+    // 0xffffffff (no point) reads back as -1
+    cv::Mat ids(height, width, CV_32SC1);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT, ids.data);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    return ids;
+}
+
+cv::Mat depth_renderer::read_normals(job_stats* stats)
+{
+    stage_timer timer;
+    // clip z = a*w + b for a perspective mvp: its z row is a times its w row plus b
+    glm::vec3 z_row(last_mvp[0][2], last_mvp[1][2], last_mvp[2][2]);
+    glm::vec3 w_row(last_mvp[0][3], last_mvp[1][3], last_mvp[2][3]);
+    float a = glm::dot(z_row, w_row)/glm::dot(w_row, w_row);
+    float b = last_mvp[3][2] - a*last_mvp[3][3];
+    glm::mat4 inverse_mvp = glm::inverse(last_mvp);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, normal_fbo);
+    glViewport(0, 0, width, height);
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(normalProgram);
+    glUniform1i(glGetUniformLocation(normalProgram, "src"), 0);
+    glUniform1i(glGetUniformLocation(normalProgram, "src_f32"), 1);
+    glUniform1i(glGetUniformLocation(normalProgram, "float_output"), float_output ? 1 : 0);
+    glUniformMatrix4fv(glGetUniformLocation(normalProgram, "inverse_mvp"), 1, GL_FALSE, &inverse_mvp[0][0]);
+    glUniform2f(glGetUniformLocation(normalProgram, "depth_ab"), a, b);
+    glActiveTexture(float_output ? GL_TEXTURE1 : GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, offline_tex);
+    glBindVertexArray(pool_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glEnable(GL_DEPTH_TEST);
+#ifndef DEPTH_MAP_NO_STATS
+    if (stats)
+        glFinish();
+#endif
+    timer.lap(stats, STAGE_DRAW);
+
+    cv::Mat normals(height, width, CV_32FC3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_FLOAT, normals.data);
+    timer.lap(stats, STAGE_READBACK);
+    return normals;
+}
+
+void depth_renderer::destroy()
+{
+    // Properly de-allocate all resources once they've outlived their purpose
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &corner_vbo);
+    glDeleteBuffers(1, &spacing_vbo);
+    glDeleteVertexArrays(1, &adaptive_vao);
+    glDeleteProgram(adaptiveProgram);
+    glDeleteVertexArrays(1, &batch_vao);
+    glDeleteProgram(batchProgram);
+    glDeleteTextures((GLsizei)fill_tex.size(), fill_tex.empty() ? NULL : &fill_tex[0]);
+    fill_tex.clear();
+    glDeleteProgram(fillProgram);
+    glDeleteProgram(shaderProgram);
+    glDeleteTextures(1, &nearest_tex);
+    glDeleteProgram(splatProgram);
+    glDeleteProgram(resolveProgram);
+    //Delete resources
+    glDeleteTextures(1, &offline_tex);
+    glDeleteRenderbuffers(1, &rbo);
+    glDeleteTextures(1, &depth_tex);
+    glDeleteFramebuffers(1, &resolve_fbo);
+    glDeleteProgram(linearProgram);
+    glDeleteTextures(1, &id_tex);
+    glDeleteTextures(1, &normal_tex);
+    glDeleteFramebuffers(1, &normal_fbo);
+    glDeleteProgram(normalProgram);
+    //Bind 0, which means render to back buffer, as a result, fb is unbound
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    for (size_t i=0; i<levels.size(); i++)
+    {
+        glDeleteTextures(1, &levels[i].tex);
+        glDeleteFramebuffers(1, &levels[i].fbo);
+    }
+    levels.clear();
+    glDeleteVertexArrays(1, &pool_vao);
+    glDeleteProgram(poolProgram);
+}
@@ -0,0 +1,177 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#define OPENCV_REQUIRED
+#include "../common/shader.h"
+
+#include "cloud_batch.h"
+#include "stats.h"
+
+#include <string>
+
+// Renders point clouds into depth images the way depth.vert/geo/frag define them:
+// every point becomes a square of +-patchsize in clip space, the nearest one wins,
+// and a pixel holds round(z*10) as u16 (the png value) or z/1000 as f32, 0 if empty.
+class depth_rasterizer
+{
+public:
+    virtual ~depth_rasterizer() {}
+
+    // float_output: f32 image with unquantized depth instead of the u16 png values
+    virtual bool init(int width, int height, bool float_output) = 0;
+    virtual void destroy() = 0;
+
+    // draws count points (xyz triples) and returns the depth image, rows top-down
+    virtual cv::Mat render(const GLfloat* xyz, size_t count, const glm::mat4& mvp, job_stats* stats = NULL) = 0;
+    cv::Mat render(const std::vector<GLfloat>& points, const glm::mat4& mvp, job_stats* stats = NULL)
+    {
+        return render(points.empty() ? NULL : &(points[0]), points.size()/3, mvp, stats);
+    }
+
+    // CV_32SC1 index into the last render's points of the point each pixel shows, -1
+    // where none does, at full size; empty unless the renderer was set up for ids
+    virtual cv::Mat read_ids() = 0;
+
+    // adds a smaller output level, call after init; returns its index for read_level
+    virtual int add_level(int width, int height) = 0;
+    // min-pools the last render into level i and returns it: every pixel keeps the
+    // nearest depth among the full size pixels it covers, so edges never get mixed
+    virtual cv::Mat read_level(int i, job_stats* stats = NULL) = 0;
+};
+
+// how depth_renderer turns points into squares
+enum splat_path
+{
+    SPLAT_GEOMETRY,     // depth.vert/geo/frag, the geometry shader emits a quad per point
+    SPLAT_INSTANCED,    // depth_quad.vert/depth.frag, a 4 vertex strip instanced once per point
+    SPLAT_COMPUTE       // depth_splat.comp writes the nearest z with image atomics, depth_resolve.comp
+                        // converts it to the output format; needs GL 4.3 compute shaders
+};
+
+bool parse_splat_path(const std::string& name, splat_path& path);
+bool parse_target(const std::string& name, bool& depth_only);
+
+// how depth_renderer submits a cloud_batch
+enum batch_submit
+{
+    BATCH_MULTI_DRAW,   // one glMultiDrawArraysIndirect over the uploaded batch
+    BATCH_PER_CLOUD     // a glBufferData and a glDrawArrays per cloud, for comparison
+};
+
+bool parse_batch_submit(const std::string& name, batch_submit& submit);
+
+// GL objects needed to render depth maps: vao/vbo for the points, the offline
+// fbo with its colour texture and depth renderbuffer, and the depth program,
+// plus one texture/fbo per smaller output level and the min-pool program.
+// With depth_only the offline fbo has no colour attachment: depth_only.frag writes
+// linear depth into a DEPTH_COMPONENT32F texture and a full screen pass
+// (depth_linear.frag) quantizes it into the colour texture, which then has an fbo
+// of its own for the readback. The compute path never draws and ignores it.
+// init, render and destroy must run with the same context current; one renderer
+// per context, so several can work in parallel on different threads.
+class depth_renderer : public depth_rasterizer
+{
+public:
+    explicit depth_renderer(splat_path path = SPLAT_GEOMETRY, bool depth_only = false);
+
+    // float_output: R32F target instead of R16UI
+    bool init(int width, int height, bool float_output);
+    void destroy();
+
+    // with stats the upload, draw and readback stages are timed; the draw is then
+    // followed by glFinish so the gpu time is not charged to the readback
+    using depth_rasterizer::render;
+    cv::Mat render(const GLfloat* xyz, size_t count, const glm::mat4& mvp, job_stats* stats = NULL);
+    // same for count points already in buffer (e.g. a cloud_cache entry), nothing is uploaded
+    cv::Mat render(GLuint buffer, GLsizei count, const glm::mat4& mvp, job_stats* stats = NULL);
+
+    // every cloud of an uploaded batch with its model matrix, then mvp (the camera's);
+    // always the geometry shader path (depth_multi.vert, depth.geo). Point ids are
+    // indices into the whole batch with BATCH_MULTI_DRAW
+    cv::Mat render(const cloud_batch& batch, const glm::mat4& mvp, batch_submit submit, job_stats* stats = NULL);
+
+    // --splat-size adaptive, with depth.geo's semantics otherwise: every point also has its
+    // local spacing (cloud.h point_spacing) and its splat reaches
+    // clamp(scale*spacing*focal/depth, 0.5, max_px) pixels from it along each axis; focal
+    // is the camera's pixel focal lengths (fx, fy) at this size. The splat path given at
+    // construction is not used
+    void set_adaptive(float scale, float max_px);
+    cv::Mat render(const GLfloat* xyz, const GLfloat* spacing, size_t count, const glm::mat4& mvp,
+        const glm::vec2& focal, job_stats* stats = NULL);
+
+    // push-pull hole filling (depth_fill.comp, GL 4.3) after every render, over levels
+    // halvings: holes up to about 2^levels pixels wide are filled, also around the edges
+    // of the cloud. threshold (png units) stops averaging across depth discontinuities.
+    // Call after init; 0 levels turns it off
+    bool set_fill(int levels, float threshold);
+
+    // extra outputs of every render, call after init. ids: index in the drawn buffer of
+    // the point each pixel shows, written by the same draw into a second (R32UI) colour
+    // attachment; not with depth_only or the compute path. normals: a full screen pass
+    // over the final depth image (depth_normal.frag), the splats themselves are flat
+    bool set_channels(bool normals, bool ids);
+    // of the last render, at its full size: point indices, -1 also where --fill made up
+    // the depth; CV_32FC3 unit normals x,y,z in the cloud's frame, 0 where undefined
+    cv::Mat read_ids();
+    cv::Mat read_normals(job_stats* stats = NULL);
+
+    // levels are min-pooled on the gpu
+    int add_level(int width, int height);
+    cv::Mat read_level(int i, job_stats* stats = NULL);
+
+private:
+    struct level
+    {
+        int width, height;
+        GLuint tex, fbo;
+    };
+
+    GLuint create_target(int width, int height);
+    cv::Mat read_target(int width, int height);
+
+    bool init_compute();
+    void splat_compute(GLuint buffer, GLsizei count, const glm::mat4& mvp);
+    bool init_adaptive();
+    bool init_batch();
+    const char* fragment_shader() const;
+    bool load_splat_program();
+    bool init_depth_only();
+    void begin_target(bool clear);
+    void resolve_depth();
+    void fill_holes();
+    cv::Mat finish_target(stage_timer& timer, job_stats* stats);
+
+    splat_path path;
+    int width, height;
+    bool float_output;
+    GLuint vao, vbo, offline_tex, fbo, rbo;
+    GLuint shaderProgram;
+    GLint MatrixID, patchsizeID;
+    // depth_only: depth texture in fbo, offline_tex in resolve_fbo
+    bool depth_only;
+    GLuint depth_tex, resolve_fbo, linearProgram;
+    // SPLAT_INSTANCED: the corners of the quad, attribute 1
+    GLuint corner_vbo;
+    // SPLAT_COMPUTE: the r32ui atomic target and its two passes
+    GLuint nearest_tex, splatProgram, resolveProgram;
+    GLint splatMatrixID, splatPatchsizeID, splatCountID;
+    // adaptive splats: the spacing attribute and their own vao and program
+    float adaptive_scale, adaptive_max;
+    GLuint spacing_vbo, adaptive_vao, adaptiveProgram;
+    GLint adaptiveMatrixID, focalID, viewportID, splatScaleID, splatMinID, splatMaxID;
+    // cloud_batch: its own vao and program, the buffers are the batch's
+    GLuint batch_vao, batchProgram;
+    GLint batchMatrixID, batchPatchsizeID;
+    // hole filling: RG32F pyramid of depth and coverage, level 0 at full size
+    std::vector<GLuint> fill_tex;
+    float fill_threshold;
+    GLuint fillProgram;
+    // extra channels: point ids in fbo's attachment 1, normals in their own fbo
+    GLuint id_tex, normal_tex, normal_fbo, normalProgram;
+    glm::mat4 last_mvp;
+    std::vector<level> levels;
+    GLuint pool_vao, poolProgram;
+    GLint ratioID;
+};
+
+#endif
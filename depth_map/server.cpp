@@ -0,0 +1,187 @@
+#include "server.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include <cstring>
+
+job_server::job_server()
+    : in(NULL), out(NULL), listen_fd(-1), pending(0)
+{
+}
+
+job_server::~job_server()
+{
+    close_connection();
+#ifndef _WIN32
+    if (listen_fd >= 0)
+        close(listen_fd);
+#endif
+}
+
+bool job_server::open(const std::string& where)
+{
+    if (where == "-")
+    {
+        // replies keep the real stdout, printf and the rest of the log go to stderr
+        fflush(stdout);
+#ifdef _WIN32
+        int fd = _dup(_fileno(stdout));
+        out = fd >= 0 ? _fdopen(fd, "w") : NULL;
+        _dup2(_fileno(stderr), _fileno(stdout));
+#else
+        int fd = dup(fileno(stdout));
+        out = fd >= 0 ? fdopen(fd, "w") : NULL;
+        dup2(fileno(stderr), fileno(stdout));
+#endif
+        in = stdin;
+        return out != NULL;
+    }
+
+    if (where.compare(0, 5, "unix:") != 0)
+    {
+        fprintf(stderr, "--serve takes - or unix:PATH, not %s\n", where.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    fprintf(stderr, "unix sockets are not supported on this platform, use --serve -\n");
+    return false;
+#else
+    std::string path = where.substr(5);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Invalid socket path %s\n", path.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    // a client hanging up must not kill the server on the next reply
+    signal(SIGPIPE, SIG_IGN);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0)
+    {
+        fprintf(stderr, "Failed to listen on %s\n", path.c_str());
+        return false;
+    }
+    printf("serving on %s\n", path.c_str());
+    fflush(stdout);
+    return true;
+#endif
+}
+
+bool job_server::accept_connection()
+{
+#ifdef _WIN32
+    return false;
+#else
+    if (listen_fd < 0)
+        return false;
+    for (;;)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        int fd_out = dup(fd);
+        in = fdopen(fd, "r");
+        out = fd_out >= 0 ? fdopen(fd_out, "w") : NULL;
+        if (in && out)
+            return true;
+        close_connection();
+    }
+#endif
+}
+
+void job_server::close_connection()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (in && in != stdin)
+        fclose(in);
+    if (out)
+        fclose(out);
+    in = out = NULL;
+    received.clear();
+}
+
+bool job_server::next(cmd& c)
+{
+    std::lock_guard<std::mutex> read_lock(read_mtx);
+    for (;;)
+    {
+        if (!in && !accept_connection())
+            return false;
+
+        std::string line;
+        char buf[4096];
+        bool got = false;
+        while (fgets(buf, sizeof(buf), in))
+        {
+            got = true;
+            line += buf;
+            if (line[line.size()-1] == '\n')
+                break;
+        }
+        if (got)
+        {
+            size_t start = line.find_first_not_of(" \t\r\n");
+            if (start == std::string::npos || line[start] == '#')
+                continue;
+            if (!parse_job(line, c))
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                fprintf(stderr, "expected \"ply png calib panel camera\", got %s", line.c_str());
+                fprintf(out, "{\"status\": \"invalid\"}\n");
+                fflush(out);
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            pending++;
+            received.insert(std::make_pair(c.png_name, precise_time()));
+            return true;
+        }
+
+        // end of the stream: its replies go out before the connection is closed
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            idle.wait(lock, [this]{ return pending == 0; });
+        }
+        bool was_stdin = in == stdin;
+        close_connection();
+        if (was_stdin)
+            return false;
+    }
+}
+
+void job_server::reply(const std::string& key, const char* status)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    double ms = 0;
+    std::multimap<std::string, double>::iterator it = received.find(key);
+    if (it != received.end())
+    {
+        ms = 1000.0*(precise_time() - it->second);
+        received.erase(it);
+    }
+    if (out)
+    {
+        fprintf(out, "{\"key\": \"");
+        for (size_t i = 0; i < key.size(); i++)
+        {
+            if (key[i] == '"' || key[i] == '\\')
+                fputc('\\', out);
+            fputc(key[i], out);
+        }
+        fprintf(out, "\", \"status\": \"%s\", \"ms\": %.3f}\n", status, ms);
+        fflush(out);
+    }
+    pending--;
+    idle.notify_all();
+}
@@ -0,0 +1,49 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include "jobs.h"
+#include "stats.h"
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+
+// Job records for --serve, so one process keeps its contexts, programs and caches
+// warm across many small batches. Requests are list lines "ply png calib panel camera",
+// either on stdin or on connections to a unix domain socket (POSIX only), served one
+// connection at a time. Every request gets a completion record on the same stream,
+//   {"key": "out.png", "status": "done", "ms": 12.345}
+// with status done, skipped (--resume) or failed and ms counted from the request being
+// read; records come in completion order. In stdin mode the records own stdout and
+// the log is moved to stderr.
+class job_server
+{
+public:
+    job_server();
+    ~job_server();
+
+    // "-" for stdin/stdout, "unix:PATH" for a socket at PATH
+    bool open(const std::string& where);
+
+    // blocks for the next request; at the end of a connection waits for its replies,
+    // then takes the next connection. false once stdin is exhausted
+    bool next(cmd& c);
+    void reply(const std::string& key, const char* status);
+
+private:
+    bool accept_connection();
+    void close_connection();
+
+    std::mutex read_mtx;   // one reader at a time, held across connection changes
+    std::mutex mtx;        // pending requests and the reply stream
+    std::condition_variable idle;
+    FILE* in;
+    FILE* out;
+    int listen_fd;
+    long pending;
+    std::multimap<std::string, double> received;    // precise_time() of each request
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "stats.h"
+
+#include <cmath>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <chrono>
+#endif
+
+// histogram buckets: 100 per decade from 1us to 1000s
+static const int buckets_per_decade = 100;
+static const int decades = 9;
+
+static const char* stage_names[STAGE_COUNT] = {
+    "parse", "filter", "upload", "draw", "readback", "encode"
+};
+
+#ifdef _WIN32
+static double counter_period()
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return 1.0/(double)frequency.QuadPart;
+}
+
+// file scope, set before main: function statics are not initialized thread safely on VS2012
+static const double qpc_period = counter_period();
+
+double precise_time()
+{
+    LARGE_INTEGER count;
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart*qpc_period;
+}
+#else
+double precise_time()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+const char* stage_name(stage st)
+{
+    return stage_names[st];
+}
+
+job_stats::job_stats()
+    : points_loaded(0), points_kept(0), bytes_read(0), bytes_written(0)
+{
+    for (int i = 0; i < STAGE_COUNT; i++)
+        seconds[i] = 0.0;
+}
+
+stats_log::stats_log()
+    : file(NULL), csv(false), jobs(0),
+      points_loaded(0), points_kept(0), bytes_read(0), bytes_written(0)
+{
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        total[i] = 0.0;
+        histogram[i].assign(buckets_per_decade*decades + 1, 0);
+    }
+}
+
+stats_log::~stats_log()
+{
+    if (file)
+        fclose(file);
+}
+
+bool stats_log::open(const std::string& path)
+{
+    file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        fprintf(stderr, "cannot write stats %s\n", path.c_str());
+        return false;
+    }
+    csv = path.size() >= 4 && path.compare(path.size()-4, 4, ".csv") == 0;
+    if (csv)
+    {
+        fprintf(file, "key");
+        for (int i = 0; i < STAGE_COUNT; i++)
+            fprintf(file, ",%s_ms", stage_names[i]);
+        fprintf(file, ",points_loaded,points_kept,bytes_read,bytes_written\n");
+    }
+    return true;
+}
+
+static int bucket(double seconds)
+{
+    double us = seconds * 1e6;
+    if (us <= 1.0)
+        return 0;
+    int b = (int)(std::log10(us) * buckets_per_decade);
+    return b > buckets_per_decade*decades ? buckets_per_decade*decades : b;
+}
+
+void stats_log::record(const job_stats& s)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    jobs++;
+    points_loaded += s.points_loaded;
+    points_kept += s.points_kept;
+    bytes_read += s.bytes_read;
+    bytes_written += s.bytes_written;
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        total[i] += s.seconds[i];
+        histogram[i][bucket(s.seconds[i])]++;
+    }
+
+    if (csv)
+    {
+        // keys are file names, quoted in case they contain commas
+        fprintf(file, "\"%s\"", s.key.c_str());
+        for (int i = 0; i < STAGE_COUNT; i++)
+            fprintf(file, ",%.3f", s.seconds[i]*1000.0);
+        fprintf(file, ",%lld,%lld,%lld,%lld\n", s.points_loaded, s.points_kept, s.bytes_read, s.bytes_written);
+    }
+    else
+    {
+        fprintf(file, "{\"key\": \"");
+        for (size_t i = 0; i < s.key.size(); i++)
+        {
+            if (s.key[i] == '"' || s.key[i] == '\\')
+                fputc('\\', file);
+            fputc(s.key[i], file);
+        }
+        fprintf(file, "\"");
+        for (int i = 0; i < STAGE_COUNT; i++)
+            fprintf(file, ", \"%s_ms\": %.3f", stage_names[i], s.seconds[i]*1000.0);
+        fprintf(file, ", \"points_loaded\": %lld, \"points_kept\": %lld, \"bytes_read\": %lld, \"bytes_written\": %lld}\n",
+            s.points_loaded, s.points_kept, s.bytes_read, s.bytes_written);
+    }
+}
+
+void stats_log::summary()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (file)
+        fflush(file);
+    printf("stats: %ld jobs, %lld points loaded, %lld kept, %lld bytes read, %lld written\n",
+        jobs, points_loaded, points_kept, bytes_read, bytes_written);
+    if (jobs == 0)
+        return;
+    printf("%-10s %10s %10s %10s %10s %10s\n", "stage", "total_s", "mean_ms", "p50_ms", "p95_ms", "p99_ms");
+    const double q[3] = {0.50, 0.95, 0.99};
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        double p[3];
+        for (int k = 0; k < 3; k++)
+        {
+            // upper edge of the bucket holding the q-th job
+            long rank = (long)std::ceil(q[k]*jobs), seen = 0;
+            size_t b = 0;
+            for (; b < histogram[i].size(); b++)
+            {
+                seen += histogram[i][b];
+                if (seen >= rank)
+                    break;
+            }
+            p[k] = std::pow(10.0, (double)(b+1)/buckets_per_decade) / 1000.0;
+        }
+        printf("%-10s %10.3f %10.3f %10.3f %10.3f %10.3f\n", stage_names[i],
+            total[i], total[i]/jobs*1000.0, p[0], p[1], p[2]);
+    }
+}
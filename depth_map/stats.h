@@ -0,0 +1,86 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdio>
+
+// Per-job stage timings and counters for --stats. Building with DEPTH_MAP_NO_STATS
+// turns stage_timer into an empty object, so the timed code carries no clock calls.
+enum stage
+{
+    STAGE_PARSE,    // ply_read into the raw xyz buffer
+    STAGE_FILTER,   // dropping points outside the region of interest
+    STAGE_UPLOAD,   // vertex buffer upload
+    STAGE_DRAW,     // draw call until the gpu is done
+    STAGE_READBACK, // glReadPixels into the output image
+    STAGE_ENCODE,   // png/raw/npy/stack write on the encoder thread
+    STAGE_COUNT
+};
+
+struct job_stats
+{
+    std::string key;
+    double seconds[STAGE_COUNT];
+    long long points_loaded, points_kept;
+    long long bytes_read, bytes_written;
+
+    job_stats();
+};
+
+// Monotonic seconds from an arbitrary origin, for stage, startup and reply times.
+// QueryPerformanceCounter on windows, where VS2012's steady_clock is system_clock and
+// ticks every 1-15.6 ms, too coarse for uploads and readbacks; steady_clock elsewhere.
+double precise_time();
+
+#ifndef DEPTH_MAP_NO_STATS
+class stage_timer
+{
+public:
+    stage_timer() : begin(precise_time()) {}
+    // adds the time since construction or the last lap to s's entry for st
+    void lap(job_stats* s, stage st)
+    {
+        double now = precise_time();
+        if (s)
+            s->seconds[st] += now - begin;
+        begin = now;
+    }
+private:
+    double begin;
+};
+#else
+class stage_timer
+{
+public:
+    void lap(job_stats*, stage) {}
+};
+#endif
+
+// Writes one line per job, CSV if the file name ends in .csv and JSON lines otherwise,
+// and keeps a log-scale histogram per stage for the p50/p95/p99 summary.
+class stats_log
+{
+public:
+    stats_log();
+    ~stats_log();
+
+    bool open(const std::string& path);
+    bool is_open() const { return file != NULL; }
+    void record(const job_stats& s);
+    void summary();
+
+private:
+    std::mutex mtx;
+    FILE* file;
+    bool csv;
+    long jobs;
+    long long points_loaded, points_kept, bytes_read, bytes_written;
+    double total[STAGE_COUNT];
+    std::vector<long> histogram[STAGE_COUNT];
+};
+
+const char* stage_name(stage st);
+
+#endif
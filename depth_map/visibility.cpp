@@ -0,0 +1,99 @@
+#include "visibility.h"
+#include "project.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+visibility_map::visibility_map(size_t num_points, int num_cameras)
+    : num_points(num_points), bits(num_cameras, std::vector<uint64_t>((num_points + 63)/64, 0))
+{
+}
+
+void visibility_map::add_camera(int c, const cv::Mat& depth, const cv::Mat& ids, const std::vector<GLfloat>& xyz,
+    const std::vector<int>& vertices, const glm::mat4& mvp, float tolerance)
+{
+    for (int y = 0; y < ids.rows; y++)
+    {
+        const int* row = ids.ptr<int>(y);
+        for (int x = 0; x < ids.cols; x++)
+            if (row[x] >= 0)
+                see(c, vertices[row[x]]);
+    }
+    if (tolerance <= 0.0f)
+        return;
+
+    // every point against the depth at its own pixel, projected in blocks
+    const size_t block = 4096;
+    std::vector<float> bx(block), by(block), bz(block), sx(block), sy(block), cz(block), cw(block);
+    size_t n = xyz.size()/3;
+    for (size_t begin = 0; begin < n; begin += block)
+    {
+        size_t m = std::min(block, n - begin);
+        for (size_t i = 0; i < m; i++)
+        {
+            bx[i] = xyz[3*(begin + i)];
+            by[i] = xyz[3*(begin + i) + 1];
+            bz[i] = xyz[3*(begin + i) + 2];
+        }
+        project_points(mvp, &bx[0], &by[0], &bz[0], m, depth.cols, depth.rows, &sx[0], &sy[0], &cz[0], &cw[0]);
+        for (size_t i = 0; i < m; i++)
+        {
+            if (!(cw[i] > 0.0f && -cw[i] <= cz[i] && cz[i] <= cw[i]))
+                continue;
+            int px = (int)std::floor(sx[i]), py = (int)std::floor(sy[i]);
+            if (px < 0 || py < 0 || px >= depth.cols || py >= depth.rows)
+                continue;
+            // the f32 image holds clip z/1000, 0 where empty
+            float d = depth.ptr<float>(py)[px]*1000.0f;
+            if (d > 0.0f && cz[i] <= d + tolerance)
+                see(c, vertices[begin + i]);
+        }
+    }
+}
+
+void visibility_map::build(std::vector<uint64_t>& offsets, std::vector<uint16_t>& cameras) const
+{
+    offsets.assign(num_points + 1, 0);
+    for (size_t c = 0; c < bits.size(); c++)
+        for (size_t i = 0; i < num_points; i++)
+            if (bits[c][i >> 6] >> (i & 63) & 1)
+                offsets[i + 1]++;
+    for (size_t i = 0; i < num_points; i++)
+        offsets[i + 1] += offsets[i];
+
+    // cameras in ascending order, so every point's list comes out sorted
+    cameras.resize(offsets[num_points]);
+    std::vector<uint64_t> next(offsets.begin(), offsets.end() - 1);
+    for (size_t c = 0; c < bits.size(); c++)
+        for (size_t i = 0; i < num_points; i++)
+            if (bits[c][i >> 6] >> (i & 63) & 1)
+                cameras[next[i]++] = (uint16_t)c;
+}
+
+bool visibility_map::write(const std::string& path, const std::vector<int>& camera_numbers) const
+{
+    std::vector<uint64_t> offsets;
+    std::vector<uint16_t> cameras;
+    build(offsets, cameras);
+
+    std::ofstream out(path.c_str(), std::ios::binary);
+    if (!out.is_open())
+    {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return false;
+    }
+    uint64_t n = num_points;
+    uint32_t counts[2] = {(uint32_t)camera_numbers.size(), 0};
+    out.write("DMVIS001", 8);
+    out.write((const char*)&n, sizeof(n));
+    out.write((const char*)counts, sizeof(counts));
+    if (!camera_numbers.empty())
+        out.write((const char*)&camera_numbers[0], sizeof(int)*camera_numbers.size());
+    out.write((const char*)&offsets[0], sizeof(uint64_t)*offsets.size());
+    if (!cameras.empty())
+        out.write((const char*)&cameras[0], sizeof(uint16_t)*cameras.size());
+    out.close();
+    return !out.fail();
+}
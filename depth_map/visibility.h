@@ -0,0 +1,52 @@
+#ifndef __VISIBILITY_H__
+#define __VISIBILITY_H__
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <opencv2/core/core.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Which cameras of a calibration see which points of one cloud (depth_map --visibility).
+// A camera sees a point when the point wins a pixel of the camera's point id render,
+// and with a tolerance also when the point lies within it of the rendered depth at
+// its own pixel: on a dense surface most points are covered by their neighbours'
+// splats at the same depth without being occluded.
+//
+// One bit per point and camera while the cameras are added, then turned into CSR:
+// the cameras of point i are cameras[offsets[i] .. offsets[i+1]), ascending.
+class visibility_map
+{
+public:
+    visibility_map(size_t num_points, int num_cameras);
+
+    size_t points() const { return num_points; }
+    int cameras() const { return (int)bits.size(); }
+
+    void see(int camera, size_t point) { bits[camera][point >> 6] |= (uint64_t)1 << (point & 63); }
+
+    // marks the points camera c sees in its render of the cloud: depth (CV_32FC1, --dtype
+    // f32) and ids (depth_rasterizer::read_ids) rendered from xyz, the points after
+    // filtering, with mvp; vertices are their ply vertex numbers. tolerance in clip z
+    // units, 0 for the ids alone
+    void add_camera(int c, const cv::Mat& depth, const cv::Mat& ids, const std::vector<GLfloat>& xyz,
+        const std::vector<int>& vertices, const glm::mat4& mvp, float tolerance);
+
+    void build(std::vector<uint64_t>& offsets, std::vector<uint16_t>& cameras) const;
+
+    // binary, little endian:
+    //   char[8]  "DMVIS001"
+    //   uint64   points N (ply vertices), uint32 cameras C, uint32 0
+    //   int32    C camera numbers, panel*100 + camera, in the order cameras are indexed
+    //   uint64   N+1 offsets
+    //   uint16   offsets[N] camera indices
+    bool write(const std::string& path, const std::vector<int>& camera_numbers) const;
+
+private:
+    size_t num_points;
+    std::vector<std::vector<uint64_t> > bits;
+};
+
+#endif
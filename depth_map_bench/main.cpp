@@ -0,0 +1,541 @@
+// End-to-end benchmark for depth_map: generates synthetic clouds and a calibration
+// with many cameras, renders every cloud from every camera by running depth_map and
+// reports maps/s and points/s, plus the per-stage times depth_map logs with --stats.
+//
+// Run it from the directory depth_map is normally run from (it needs ./shaders).
+// --software forces Mesa's llvmpipe so the suite runs on machines without a gpu;
+// depth_map then has to be a DEPTH_MAP_WITH_EGL build. --splats runs every cloud once
+// per gl splatting path (depth_map --splat) to compare them at each size.
+//
+// --scene N,P instead renders one scene of N clouds of P points each (depth_map's
+// .scene jobs, depth_map/cloud_batch.h) with both --batch modes: a single multi draw
+// indirect, and an upload and a draw per cloud.
+//
+// --project N instead times the cpu projection kernel (depth_map/project.h) on N
+// points for every isa this cpu supports, against one glm mat4*vec4 per point.
+
+#include "../3rdparty/rply-1.1.4/rply.h"
+#include "../depth_map/project.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <json/json.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <sys/stat.h>
+
+// same stage order as depth_map's --stats csv
+static const char* stages[] = { "parse", "filter", "upload", "draw", "readback", "encode" };
+static const int num_stages = 6;
+
+struct cloud_spec
+{
+    long points;
+    bool binary;
+    bool faces;
+    std::string ply_name;
+};
+
+static bool file_exists(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+// Points scattered over a wavy cylinder shell around the y axis, inside the region
+// depth_map keeps (y < -5 and x^2+z^2 < 45000), so every point reaches the gpu.
+static bool write_cloud(const cloud_spec& spec, unsigned seed)
+{
+    p_ply ply = ply_create(spec.ply_name.c_str(), spec.binary ? PLY_LITTLE_ENDIAN : PLY_ASCII, NULL, 0, NULL);
+    if (!ply)
+        return false;
+    long nfaces = spec.faces ? spec.points/3 : 0;
+    ply_add_element(ply, "vertex", spec.points);
+    ply_add_scalar_property(ply, "x", PLY_FLOAT);
+    ply_add_scalar_property(ply, "y", PLY_FLOAT);
+    ply_add_scalar_property(ply, "z", PLY_FLOAT);
+    if (spec.faces)
+    {
+        ply_add_element(ply, "face", nfaces);
+        ply_add_list_property(ply, "vertex_indices", PLY_UCHAR, PLY_INT);
+    }
+    if (!ply_write_header(ply))
+    {
+        ply_close(ply);
+        return false;
+    }
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+    std::uniform_real_distribution<float> height(-180.0f, -10.0f);
+    std::normal_distribution<float> noise(0.0f, 1.5f);
+    for (long i = 0; i < spec.points; i++)
+    {
+        float a = angle(rng);
+        float y = height(rng);
+        float r = 120.0f + 25.0f*std::sin(3.0f*a)*std::cos(y/30.0f) + noise(rng);
+        ply_write(ply, r*std::cos(a));
+        ply_write(ply, y);
+        ply_write(ply, r*std::sin(a));
+    }
+    // faces are never rendered, they only cost parse time as in real meshes
+    for (long f = 0; f < nfaces; f++)
+    {
+        ply_write(ply, 3);
+        ply_write(ply, 3*f);
+        ply_write(ply, 3*f+1);
+        ply_write(ply, 3*f+2);
+    }
+    return ply_close(ply) != 0;
+}
+
+// N clouds of P points for --scene, each a small patch around (0, -10, 0) in its own
+// frame (inside the kept region there too, depth_map filters every cloud before its
+// model matrix) and translated onto the same shell as write_cloud's
+static bool write_scene(const std::string& dir, const std::string& scene_name, long num_clouds, long points, bool regenerate)
+{
+    std::ofstream scene(scene_name.c_str());
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+    std::uniform_real_distribution<float> height(-170.0f, -20.0f);
+    std::uniform_real_distribution<float> patch(-4.0f, 4.0f);
+    for (long c = 0; c < num_clouds; c++)
+    {
+        std::ostringstream name;
+        name << "c_" << points << "_" << c << ".ply";
+        std::string ply_name = dir + "/" + name.str();
+        if (regenerate || !file_exists(ply_name))
+        {
+            p_ply ply = ply_create(ply_name.c_str(), PLY_LITTLE_ENDIAN, NULL, 0, NULL);
+            if (!ply)
+                return false;
+            ply_add_element(ply, "vertex", points);
+            ply_add_scalar_property(ply, "x", PLY_FLOAT);
+            ply_add_scalar_property(ply, "y", PLY_FLOAT);
+            ply_add_scalar_property(ply, "z", PLY_FLOAT);
+            if (!ply_write_header(ply))
+            {
+                ply_close(ply);
+                return false;
+            }
+            for (long i = 0; i < points; i++)
+            {
+                ply_write(ply, patch(rng));
+                ply_write(ply, -10.0f + patch(rng));
+                ply_write(ply, patch(rng));
+            }
+            if (!ply_close(ply))
+                return false;
+        }
+        // a translation, row by row
+        float a = angle(rng);
+        scene << name.str() << " 1 0 0 " << 120.0f*std::cos(a) << " 0 1 0 " << 10.0f + height(rng)
+              << " 0 0 1 " << 120.0f*std::sin(a) << " 0 0 0 1\n";
+    }
+    return scene.good();
+}
+
+// num_cameras cameras on a ring of radius 400 looking at the cloud, named like the
+// panoptic calibrations ("pp_cc", 25 cameras per panel)
+static bool write_calibration(const std::string& path, int num_cameras)
+{
+    Json::Value root;
+    Json::Value cameras(Json::arrayValue);
+    for (int i = 0; i < num_cameras; i++)
+    {
+        double a = 6.283185307 * i / num_cameras;
+        double C[3] = { 400.0*std::cos(a), -95.0 + 40.0*std::sin(3.0*a), 400.0*std::sin(a) };
+        double target[3] = { 0.0, -95.0, 0.0 };
+
+        // rows of R: camera x (right), y (down, world +y) and z (forward)
+        double z[3] = { target[0]-C[0], target[1]-C[1], target[2]-C[2] };
+        double zn = std::sqrt(z[0]*z[0]+z[1]*z[1]+z[2]*z[2]);
+        for (int k = 0; k < 3; k++) z[k] /= zn;
+        double y[3] = { -z[1]*z[0], 1.0 - z[1]*z[1], -z[1]*z[2] };
+        double yn = std::sqrt(y[0]*y[0]+y[1]*y[1]+y[2]*y[2]);
+        for (int k = 0; k < 3; k++) y[k] /= yn;
+        double x[3] = { y[1]*z[2]-y[2]*z[1], y[2]*z[0]-y[0]*z[2], y[0]*z[1]-y[1]*z[0] };
+        double* R[3] = { x, y, z };
+
+        Json::Value cam;
+        char name[16];
+        sprintf(name, "%02d_%02d", i/25, i%25);
+        cam["name"] = name;
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                double k = (r == c) ? (r < 2 ? 1400.0 : 1.0) : 0.0;
+                if (r == 0 && c == 2) k = 960.0;
+                if (r == 1 && c == 2) k = 540.0;
+                cam["K"][r][c] = k;
+                cam["R"][r][c] = R[r][c];
+            }
+            cam["t"][r][0] = -(R[r][0]*C[0] + R[r][1]*C[1] + R[r][2]*C[2]);
+        }
+        cameras.append(cam);
+    }
+    root["cameras"] = cameras;
+
+    std::ofstream out(path.c_str());
+    if (!out.is_open())
+        return false;
+    Json::StyledStreamWriter writer;
+    writer.write(out, root);
+    return out.good();
+}
+
+static std::vector<std::string> parse_names(const std::string& s)
+{
+    std::vector<std::string> names;
+    std::istringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ','))
+        names.push_back(item);
+    return names;
+}
+
+static std::vector<long> parse_sizes(const std::string& s)
+{
+    std::vector<long> sizes;
+    std::istringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ','))
+        sizes.push_back(std::atol(item.c_str()));
+    return sizes;
+}
+
+// sums the per-stage columns of a depth_map --stats csv
+static bool read_stage_totals(const std::string& path, double totals[], long& jobs)
+{
+    std::ifstream in(path.c_str());
+    std::string line;
+    if (!std::getline(in, line))
+        return false;
+    jobs = 0;
+    for (int i = 0; i < num_stages; i++)
+        totals[i] = 0.0;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string field;
+        std::getline(fields, field, ',');
+        for (int i = 0; i < num_stages && std::getline(fields, field, ','); i++)
+            totals[i] += std::atof(field.c_str());
+        jobs++;
+    }
+    return true;
+}
+
+static void set_env(const char* name, const char* value)
+{
+#ifdef _WIN32
+    _putenv_s(name, value);
+#else
+    setenv(name, value, 1);
+#endif
+}
+
+// runs depth_map on list with --stats and sums the stage times it logged
+static bool run_depth_map(const std::string& depth_map, const std::string& args, const std::string& list,
+    const std::string& stats, double& wall, double totals[], long& jobs)
+{
+    std::string cmd = "\"" + depth_map + "\" " + args + " --stats \"" + stats + "\" \"" + list + "\"";
+#ifdef _WIN32
+    cmd += " >NUL";
+#else
+    cmd += " >/dev/null";
+#endif
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    int rc = system(cmd.c_str());
+    wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    jobs = 0;
+    return rc == 0 && read_stage_totals(stats, totals, jobs) && jobs > 0;
+}
+
+// best of a few runs, in seconds
+template <typename F>
+static double best_time(F f)
+{
+    double best = 1e30;
+    for (int run = 0; run < 5; run++)
+    {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        f();
+        double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (t < best)
+            best = t;
+    }
+    return best;
+}
+
+static void bench_projection(long n)
+{
+    const int width = 384, height = 216;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> u(-200.0f, 200.0f);
+    std::vector<glm::vec3> aos(n);
+    std::vector<float> x(n), y(n), z(n);
+    for (long i = 0; i < n; i++)
+    {
+        aos[i] = glm::vec3(u(rng), u(rng) - 100.0f, u(rng));
+        x[i] = aos[i].x;
+        y[i] = aos[i].y;
+        z[i] = aos[i].z;
+    }
+    // a pinhole looking down -z from 400 units away, column-major like glm
+    const float f = 2.0f, near = 0.1f, far = 1000.0f;
+    const float proj_float[16] = {f*height/width, 0.0f, 0.0f, 0.0f,
+        0.0f, f, 0.0f, 0.0f,
+        0.0f, 0.0f, (far + near)/(near - far), -1.0f,
+        0.0f, 0.0f, 2.0f*far*near/(near - far), 0.0f};
+    const float view_float[16] = {1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 100.0f, -400.0f, 1.0f};
+    glm::mat4 mvp = glm::make_mat4(proj_float)*glm::make_mat4(view_float);
+
+    std::vector<float> ref_x(n), ref_y(n), ref_z(n), ref_w(n);
+    const float hw = 0.5f*width, hh = 0.5f*height;
+    double t_glm = best_time([&]
+    {
+        for (long i = 0; i < n; i++)
+        {
+            glm::vec4 c = mvp*glm::vec4(aos[i], 1.0f);
+            ref_x[i] = (c.x/c.w + 1.0f)*hw;
+            ref_y[i] = (c.y/c.w + 1.0f)*hh;
+            ref_z[i] = c.z;
+            ref_w[i] = c.w;
+        }
+    });
+    printf("%-8s %10s %10s %12s\n", "isa", "ms", "Mpts/s", "max_diff_px");
+    printf("%-8s %10.3f %10.1f %12s\n", "glm", t_glm*1000.0, n/t_glm/1e6, "-");
+
+    std::vector<float> sx(n), sy(n), cz(n), cw(n);
+    const project_isa isas[] = { PROJECT_SCALAR, PROJECT_SSE, PROJECT_AVX2, PROJECT_NEON };
+    for (int k = 0; k < 4; k++)
+    {
+        if (!project_isa_supported(isas[k]))
+            continue;
+        double t = best_time([&]
+        {
+            project_points(isas[k], mvp, &x[0], &y[0], &z[0], n, width, height, &sx[0], &sy[0], &cz[0], &cw[0]);
+        });
+        float diff = 0.0f;
+        for (long i = 0; i < n; i++)
+            if (ref_w[i] > 0.0f)
+                diff = std::max(diff, std::max(std::fabs(sx[i] - ref_x[i]), std::fabs(sy[i] - ref_y[i])));
+        printf("%-8s %10.3f %10.1f %12g\n", project_isa_name(isas[k]), t*1000.0, n/t/1e6, diff);
+    }
+    printf("dispatch picks %s\n", project_isa_name(project_best_isa()));
+}
+
+void usage()
+{
+    std::cout<<"usage: depth_map_bench [options]\n";
+    std::cout<<"options:\n";
+    std::cout<<"  --sizes A,B,...     cloud sizes in points (default: 100000,1000000,10000000; up to 50000000)\n";
+    std::cout<<"  --cameras N         cameras in the generated calibration (default: 64)\n";
+    std::cout<<"  --views N           cameras each cloud is rendered from (default: all)\n";
+    std::cout<<"  --dir D             where clouds, lists and outputs go (default: bench_data)\n";
+    std::cout<<"  --depth-map EXE     depth_map to run (default: ./depth_map)\n";
+    std::cout<<"  --args \"...\"        extra depth_map options, e.g. \"--threads 4 --png-level 1\"\n";
+    std::cout<<"  --splats P,P,...    gl splatting paths to run each cloud with: geometry, instanced, compute\n";
+    std::cout<<"                      (default: depth_map's default)\n";
+    std::cout<<"  --software          force mesa llvmpipe (needs a DEPTH_MAP_WITH_EGL build)\n";
+    std::cout<<"  --regenerate        rewrite clouds that already exist\n";
+    std::cout<<"  --scene N,P         only render a scene of N clouds of P points, multi draw against a draw per cloud\n";
+    std::cout<<"  --project N         only benchmark the cpu projection kernel on N points\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<long> sizes = parse_sizes("100000,1000000,10000000");
+    int num_cameras = 64;
+    int views = -1;
+    std::string dir = "bench_data";
+    std::string depth_map = "./depth_map";
+    std::string extra_args;
+    // empty: depth_map's default path, without a --splat option
+    std::vector<std::string> splats(1, std::string());
+    bool software = false, regenerate = false;
+    long scene_clouds = 0, scene_points = 0;
+
+    for (int i=1; i<argc; i++)
+    {
+        std::string a = argv[i];
+        bool has_value = i+1 < argc;
+        if (a == "--software")
+            software = true;
+        else if (a == "--regenerate")
+            regenerate = true;
+        else if (a == "--sizes" && has_value)
+            sizes = parse_sizes(argv[++i]);
+        else if (a == "--cameras" && has_value)
+            num_cameras = std::atoi(argv[++i]);
+        else if (a == "--views" && has_value)
+            views = std::atoi(argv[++i]);
+        else if (a == "--dir" && has_value)
+            dir = argv[++i];
+        else if (a == "--depth-map" && has_value)
+            depth_map = argv[++i];
+        else if (a == "--splats" && has_value)
+            splats = parse_names(argv[++i]);
+        else if (a == "--args" && has_value)
+            extra_args = argv[++i];
+        else if (a == "--scene" && has_value && parse_sizes(argv[i+1]).size() == 2)
+        {
+            std::vector<long> scene = parse_sizes(argv[++i]);
+            scene_clouds = scene[0];
+            scene_points = scene[1];
+        }
+        else if (a == "--project" && has_value)
+        {
+            bench_projection(std::atol(argv[++i]));
+            return 0;
+        }
+        else
+        {
+            usage();
+            exit(-1);
+        }
+    }
+    if (views < 1 || views > num_cameras)
+        views = num_cameras;
+
+    if (software)
+    {
+        set_env("LIBGL_ALWAYS_SOFTWARE", "1");
+        set_env("GALLIUM_DRIVER", "llvmpipe");
+    }
+
+#ifdef _WIN32
+    std::string mkdir_cmd = "mkdir \"" + dir + "\" 2>NUL";
+#else
+    std::string mkdir_cmd = "mkdir -p \"" + dir + "\"";
+#endif
+    system(mkdir_cmd.c_str());
+
+    std::string calib = dir + "/calib.json";
+    if (!write_calibration(calib, num_cameras))
+    {
+        fprintf(stderr, "cannot write %s\n", calib.c_str());
+        exit(-1);
+    }
+
+    if (scene_clouds > 0)
+    {
+        std::string scene_name = dir + "/bench.scene";
+        printf("generating %s, %ld clouds of %ld points\n", scene_name.c_str(), scene_clouds, scene_points);
+        if (!write_scene(dir, scene_name, scene_clouds, scene_points, regenerate))
+        {
+            fprintf(stderr, "cannot write %s\n", scene_name.c_str());
+            exit(-1);
+        }
+        std::string list = dir + "/list.txt";
+        std::string stats = dir + "/stats.csv";
+        {
+            std::ofstream out(list.c_str());
+            for (int v = 0; v < views; v++)
+                out << scene_name << " " << dir << "/out_" << v << ".png " << calib << " " << v/25 << " " << v%25 << "\n";
+        }
+
+        // the scene is read and uploaded by the first view only, draw_ms is the per frame cost
+        printf("%-8s %6s %9s %9s %12s", "batch", "maps", "wall_s", "maps/s", "clouds/s");
+        for (int i = 0; i < num_stages; i++)
+            printf(" %9s", (std::string(stages[i]) + "_ms").c_str());
+        printf("\n");
+        const char* modes[] = { "multi", "loop" };
+        int failures = 0;
+        for (int m = 0; m < 2; m++)
+        {
+            double wall, totals[num_stages];
+            long jobs;
+            if (!run_depth_map(depth_map, extra_args + " --batch " + modes[m], list, stats, wall, totals, jobs))
+            {
+                fprintf(stderr, "depth_map failed on %s with --batch %s\n", scene_name.c_str(), modes[m]);
+                failures++;
+                continue;
+            }
+            printf("%-8s %6ld %9.2f %9.2f %12.0f", modes[m], jobs, wall, jobs/wall, (double)scene_clouds*jobs/wall);
+            for (int i = 0; i < num_stages; i++)
+                printf(" %9.2f", totals[i]/jobs);
+            printf("\n");
+            fflush(stdout);
+        }
+        return failures ? -1 : 0;
+    }
+
+    std::vector<cloud_spec> clouds;
+    for (size_t s = 0; s < sizes.size(); s++)
+    {
+        // ascii, binary, ascii with faces, binary with faces
+        for (int variant = 0; variant < 4; variant++)
+        {
+            cloud_spec spec;
+            spec.points = sizes[s];
+            spec.binary = (variant & 1) != 0;
+            spec.faces = (variant & 2) != 0;
+            std::ostringstream name;
+            name << dir << "/cloud_" << spec.points << (spec.binary ? "_bin" : "_ascii") << (spec.faces ? "_faces" : "") << ".ply";
+            spec.ply_name = name.str();
+            if (regenerate || !file_exists(spec.ply_name))
+            {
+                printf("generating %s\n", spec.ply_name.c_str());
+                if (!write_cloud(spec, (unsigned)(spec.points + variant)))
+                {
+                    fprintf(stderr, "cannot write %s\n", spec.ply_name.c_str());
+                    exit(-1);
+                }
+            }
+            clouds.push_back(spec);
+        }
+    }
+
+    printf("%-40s %-10s %6s %9s %9s %12s", "cloud", "splat", "maps", "wall_s", "maps/s", "points/s");
+    for (int i = 0; i < num_stages; i++)
+        printf(" %9s", (std::string(stages[i]) + "_ms").c_str());
+    printf("\n");
+
+    int failures = 0;
+    for (size_t run = 0; run < clouds.size()*splats.size(); run++)
+    {
+        const cloud_spec& spec = clouds[run/splats.size()];
+        const std::string& splat = splats[run%splats.size()];
+        std::string list = dir + "/list.txt";
+        std::string stats = dir + "/stats.csv";
+        {
+            std::ofstream out(list.c_str());
+            for (int v = 0; v < views; v++)
+                out << spec.ply_name << " " << dir << "/out_" << v << ".png " << calib << " " << v/25 << " " << v%25 << "\n";
+        }
+
+        double wall, totals[num_stages];
+        long jobs;
+        if (!run_depth_map(depth_map, extra_args + (splat.empty() ? "" : " --splat " + splat), list, stats, wall, totals, jobs))
+        {
+            fprintf(stderr, "depth_map failed on %s with %s\n", spec.ply_name.c_str(), splat.empty() ? "its default splatting" : splat.c_str());
+            failures++;
+            continue;
+        }
+
+        // wall time includes process start, context creation and shader compilation
+        printf("%-40s %-10s %6ld %9.2f %9.2f %12.0f", spec.ply_name.c_str(), splat.empty() ? "default" : splat.c_str(), jobs, wall, jobs/wall, (double)spec.points*jobs/wall);
+        for (int i = 0; i < num_stages; i++)
+            printf(" %9.2f", totals[i]/jobs);
+        printf("\n");
+        fflush(stdout);
+    }
+    return failures ? -1 : 0;
+}
@@ -0,0 +1,315 @@
+// Cross-validation of two depth_map backends: renders every job of a list twice, once
+// with each set of depth_map options (by default the gl and the cpu renderer), and
+// compares the 16-bit outputs pixel by pixel on several threads.
+//
+// Per output it reports how well the covered pixels agree (pixels valid in only one
+// of the two, over pixels valid in either) and the mean and max absolute difference
+// where both are valid, in png units. Heatmaps show the disagreement: red where only
+// A has depth, blue where only B has, black to green to yellow for the difference
+// elsewhere. Exits with 1 when an output is over a threshold, -1 when a render fails.
+//
+// The options of both sides must keep depth_map's default output: one 16-bit png per
+// job (--format png, --dtype u16, a single scale).
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+struct job
+{
+    std::string line;       // the list line with its png name replaced by {}
+    std::string png_name;   // as given in the list
+    std::string a_name, b_name, heat_name;
+};
+
+struct comparison
+{
+    bool ok;                    // both outputs could be read and have the same size
+    // 64-bit counts, long is 32 bits on windows and ~1000 full hd outputs overflow it
+    long long only_a, only_b;   // pixels valid in one output only
+    long long both;             // pixels valid in both
+    double sum_diff;            // over the pixels valid in both
+    int max_diff;
+    bool failed;                // over a threshold
+
+    comparison() : ok(false), only_a(0), only_b(0), both(0), sum_diff(0.0), max_diff(0), failed(false) {}
+    long long either() const { return only_a + only_b + both; }
+    double disagreement() const { return either() ? (double)(only_a + only_b)/either() : 0.0; }
+    double mean_diff() const { return both ? sum_diff/both : 0.0; }
+};
+
+// "ply png calib panel camera" lines like depth_map's list; others are skipped, and
+// like depth_map (jobs.cpp) so are # comments
+static bool read_jobs(const std::string& list, std::vector<job>& jobs)
+{
+    std::ifstream in(list.c_str());
+    if (!in.is_open())
+        return false;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string ply, png, calib, panel, camera;
+        if (!(fields >> ply >> png >> calib >> panel >> camera))
+            continue;
+        job j;
+        j.png_name = png;
+        j.line = ply + " {} " + calib + " " + panel + " " + camera;
+        jobs.push_back(j);
+    }
+    return true;
+}
+
+static bool write_list(const std::string& path, const std::vector<job>& jobs, bool side_a)
+{
+    std::ofstream out(path.c_str());
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        std::string line = jobs[i].line;
+        line.replace(line.find("{}"), 2, side_a ? jobs[i].a_name : jobs[i].b_name);
+        out << line << "\n";
+    }
+    return out.good();
+}
+
+static void make_dir(const std::string& dir)
+{
+#ifdef _WIN32
+    std::string cmd = "mkdir \"" + dir + "\" 2>NUL";
+#else
+    std::string cmd = "mkdir -p \"" + dir + "\"";
+#endif
+    system(cmd.c_str());
+}
+
+// difference 0 is dark gray so it stands out from pixels neither output covers
+static cv::Vec3b heat_color(int diff, double heat_range)
+{
+    if (diff == 0)
+        return cv::Vec3b(48, 48, 48);
+    double t = std::min(1.0, diff/heat_range);
+    // black, green, yellow in bgr: never the pure red or blue of one-side pixels
+    return cv::Vec3b(0, (uchar)(255*std::min(1.0, 2*t)), (uchar)(255*std::max(0.0, 2*t - 1)));
+}
+
+static comparison compare(const std::string& a_name, const std::string& b_name, double heat_range, cv::Mat* heat)
+{
+    comparison c;
+    cv::Mat a = cv::imread(a_name, -1), b = cv::imread(b_name, -1);
+    if (a.empty() || b.empty() || a.type() != CV_16UC1 || b.type() != CV_16UC1 || a.rows != b.rows || a.cols != b.cols)
+        return c;
+    c.ok = true;
+    if (heat)
+        heat->create(a.rows, a.cols, CV_8UC3);
+    for (int y = 0; y < a.rows; y++)
+    {
+        const unsigned short* ra = a.ptr<unsigned short>(y);
+        const unsigned short* rb = b.ptr<unsigned short>(y);
+        cv::Vec3b* rh = heat ? heat->ptr<cv::Vec3b>(y) : NULL;
+        for (int x = 0; x < a.cols; x++)
+        {
+            cv::Vec3b color(0, 0, 0);
+            if (ra[x] && rb[x])
+            {
+                int d = std::abs((int)ra[x] - (int)rb[x]);
+                c.both++;
+                c.sum_diff += d;
+                c.max_diff = std::max(c.max_diff, d);
+                color = heat_color(d, heat_range);
+            }
+            else if (ra[x])
+            {
+                c.only_a++;
+                color = cv::Vec3b(0, 0, 255);
+            }
+            else if (rb[x])
+            {
+                c.only_b++;
+                color = cv::Vec3b(255, 0, 0);
+            }
+            if (rh)
+                rh[x] = color;
+        }
+    }
+    return c;
+}
+
+void usage()
+{
+    std::cout<<"usage: depth_map_validate [options] list.txt\n";
+    std::cout<<"options:\n";
+    std::cout<<"  --a \"...\"           depth_map options of side A (default: \"--renderer gl\")\n";
+    std::cout<<"  --b \"...\"           depth_map options of side B (default: \"--renderer cpu\")\n";
+    std::cout<<"  --depth-map EXE     depth_map to run (default: ./depth_map)\n";
+    std::cout<<"  --dir D             where outputs and heatmaps go, as D/a, D/b and D/heat (default: validate_data)\n";
+    std::cout<<"  --threads N         comparison threads (default: cores)\n";
+    std::cout<<"  --max-disagree F    max fraction of covered pixels covered by one side only (default: 0.001)\n";
+    std::cout<<"  --max-mean D        max mean difference where both are valid, png units (default: 1)\n";
+    std::cout<<"  --max-diff D        max difference where both are valid, png units (default: off)\n";
+    std::cout<<"  --heatmaps W        failed (default), all or none\n";
+    std::cout<<"  --heat-range D      difference drawn in full yellow (default: 10)\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::string a_args = "--renderer gl", b_args = "--renderer cpu";
+    std::string depth_map = "./depth_map";
+    std::string dir = "validate_data";
+    int num_threads = (int)std::thread::hardware_concurrency();
+    double max_disagree = 0.001, max_mean = 1.0;
+    int max_diff = -1;
+    std::string heatmaps = "failed";
+    double heat_range = 10.0;
+    std::string list;
+
+    for (int i=1; i<argc; i++)
+    {
+        std::string a = argv[i];
+        bool has_value = i+1 < argc;
+        if (a.compare(0, 2, "--") != 0 && list.empty())
+            list = a;
+        else if (a == "--a" && has_value)
+            a_args = argv[++i];
+        else if (a == "--b" && has_value)
+            b_args = argv[++i];
+        else if (a == "--depth-map" && has_value)
+            depth_map = argv[++i];
+        else if (a == "--dir" && has_value)
+            dir = argv[++i];
+        else if (a == "--threads" && has_value)
+            num_threads = std::atoi(argv[++i]);
+        else if (a == "--max-disagree" && has_value)
+            max_disagree = std::atof(argv[++i]);
+        else if (a == "--max-mean" && has_value)
+            max_mean = std::atof(argv[++i]);
+        else if (a == "--max-diff" && has_value)
+            max_diff = std::atoi(argv[++i]);
+        else if (a == "--heatmaps" && has_value && (std::string(argv[i+1]) == "failed" ||
+                 std::string(argv[i+1]) == "all" || std::string(argv[i+1]) == "none"))
+            heatmaps = argv[++i];
+        else if (a == "--heat-range" && has_value && std::atof(argv[i+1]) > 0)
+            heat_range = std::atof(argv[++i]);
+        else
+        {
+            usage();
+            exit(-1);
+        }
+    }
+    if (list.empty())
+    {
+        usage();
+        exit(-1);
+    }
+    if (num_threads < 1)
+        num_threads = 1;
+
+    std::vector<job> jobs;
+    if (!read_jobs(list, jobs) || jobs.empty())
+    {
+        fprintf(stderr, "no jobs in %s\n", list.c_str());
+        exit(-1);
+    }
+    make_dir(dir + "/a");
+    make_dir(dir + "/b");
+    if (heatmaps != "none")
+        make_dir(dir + "/heat");
+    // list png names may repeat or live anywhere, outputs are numbered by job instead
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        char name[32];
+        sprintf(name, "/%06lu.png", (unsigned long)i);
+        jobs[i].a_name = dir + "/a" + name;
+        jobs[i].b_name = dir + "/b" + name;
+        jobs[i].heat_name = dir + "/heat" + name;
+    }
+
+    const std::string* side_args[2] = { &a_args, &b_args };
+    for (int side = 0; side < 2; side++)
+    {
+        std::string side_list = dir + (side == 0 ? "/list_a.txt" : "/list_b.txt");
+        if (!write_list(side_list, jobs, side == 0))
+        {
+            fprintf(stderr, "cannot write %s\n", side_list.c_str());
+            exit(-1);
+        }
+        std::string cmd = "\"" + depth_map + "\" " + *side_args[side] + " \"" + side_list + "\"";
+#ifdef _WIN32
+        cmd += " >NUL";
+#else
+        cmd += " >/dev/null";
+#endif
+        printf("rendering %s: %s\n", side == 0 ? "A" : "B", side_args[side]->c_str());
+        fflush(stdout);
+        int rc = system(cmd.c_str());
+        if (rc != 0)
+        {
+            fprintf(stderr, "depth_map failed for side %s (exit %d)\n", side == 0 ? "A" : "B", rc);
+            exit(-1);
+        }
+    }
+
+    std::vector<comparison> results(jobs.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++)
+    {
+        threads.push_back(std::thread([&]
+        {
+            for (size_t i = next++; i < jobs.size(); i = next++)
+            {
+                cv::Mat heat;
+                comparison& c = results[i];
+                c = compare(jobs[i].a_name, jobs[i].b_name, heat_range, heatmaps != "none" ? &heat : NULL);
+                c.failed = !c.ok || c.disagreement() > max_disagree || c.mean_diff() > max_mean ||
+                    (max_diff >= 0 && c.max_diff > max_diff);
+                if (c.ok && (heatmaps == "all" || (heatmaps == "failed" && c.failed)))
+                    cv::imwrite(jobs[i].heat_name, heat);
+            }
+        }));
+    }
+    for (auto& t:threads)
+        t.join();
+
+    printf("%-40s %10s %10s %10s %9s %9s\n", "output", "covered", "one_side", "disagree", "mean", "max");
+    comparison total;
+    int failed = 0, unreadable = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        const comparison& c = results[i];
+        if (!c.ok)
+        {
+            printf("%-40s cannot read both outputs or their sizes differ\n", jobs[i].png_name.c_str());
+            unreadable++;
+            continue;
+        }
+        printf("%-40s %10lld %10lld %9.4f%% %9.4f %9d%s\n", jobs[i].png_name.c_str(), c.either(), c.only_a + c.only_b,
+            100.0*c.disagreement(), c.mean_diff(), c.max_diff, c.failed ? "  FAIL" : "");
+        failed += c.failed ? 1 : 0;
+        total.only_a += c.only_a;
+        total.only_b += c.only_b;
+        total.both += c.both;
+        total.sum_diff += c.sum_diff;
+        total.max_diff = std::max(total.max_diff, c.max_diff);
+    }
+    printf("%-40s %10lld %10lld %9.4f%% %9.4f %9d\n", "total", total.either(), total.only_a + total.only_b,
+        100.0*total.disagreement(), total.mean_diff(), total.max_diff);
+    printf("%lu outputs, %lld pixels only in A, %lld only in B, %d over a threshold, %d unreadable\n",
+        (unsigned long)jobs.size(), total.only_a, total.only_b, failed, unreadable);
+    if (unreadable)
+        return -1;
+    return failed ? 1 : 0;
+}